@@ -0,0 +1,731 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+// Headless benchmark of the mesh generation. Needs neither Qt widgets
+// nor a GL context, links only the geometry sources.
+//
+// Usage: cg-lab03-bench [--vertices 20,100,400] [--surfaces 20,100,400]
+//                       [--threads 1,4] [--repeats 10]
+//                       [--simd scalar|sse|avx] [--json] [--deviation]
+//                       [--check-slices] [--cull 1000,100000]
+//
+// --deviation prints the slicing error per triangle budget instead of
+// timings. --check-slices sweeps every surface count up to the largest
+// one given and fails if the slices are not where they belong. --cull
+// times frustum culling of generated scenes of the given sizes and
+// fails if the hierarchy disagrees with testing every instance.
+
+#include <CompactVertex.hpp>
+#include <Ellipsoid.hpp>
+#include <MeshBuilder.hpp>
+#include <RingKernel.hpp>
+#include <Scene.hpp>
+#include <ThreadPool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<std::size_t> AllocationCount{0};
+std::atomic<std::size_t> AllocatedBytes{0};
+
+struct Options {
+    std::vector<SizeType> VertexCounts = {20, 100, 400};
+    std::vector<SizeType> SurfaceCounts = {20, 100, 400};
+    std::vector<SizeType> ThreadCounts;
+    SizeType Repeats = 10;
+    bool Json = false;
+    bool Deviation = false;
+    bool CheckSlices = false;
+    bool CheckArena = false;
+    std::vector<SizeType> InstanceCounts;
+};
+
+struct Result {
+    std::string Case;
+    SizeType VertexCount;
+    SizeType SurfaceCount;
+    SizeType Threads;
+    SizeType Vertices;
+    double BestNs;
+    double MedianNs;
+    double Allocations;
+    double Bytes;
+};
+
+// the benchmarked call returns how many vertices it produced
+using Case = std::function<SizeType()>;
+
+const LenghtType A = 1.1f;
+const LenghtType B = 1.5f;
+const LenghtType C = 0.2f;
+const float ANGLE = 0.5f;
+// view of the culled scenes, about a fifth of them is on screen
+const float CULL_ZOOM = 8.0f;
+const float SCENE_RADIUS = 0.5f;
+// rebuilds of distinct shapes in the arena check
+const SizeType ARENA_REBUILDS = 50;
+
+std::vector<SizeType> ParseList(const char* text) {
+    std::vector<SizeType> values;
+    for (auto begin = text; *begin != '\0';) {
+        char* end = nullptr;
+        const auto value = std::strtoul(begin, &end, 10);
+        if (end == begin) {
+            break;
+        }
+        values.push_back(value);
+        begin = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+// lowers the kernel level, the CPU may not support the requested one
+bool ParseLevel(const char* name) {
+    for (auto level : {RingKernel::Level::SCALAR, RingKernel::Level::SSE,
+                       RingKernel::Level::AVX}) {
+        if (std::strcmp(name, RingKernel::GetLevelName(level)) == 0) {
+            RingKernel::SetLevel(level);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    auto isValid = true;
+    for (auto i = 1; i < argc && isValid; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0) {
+            options.Json = true;
+        } else if (std::strcmp(argv[i], "--deviation") == 0) {
+            options.Deviation = true;
+        } else if (std::strcmp(argv[i], "--check-slices") == 0) {
+            options.CheckSlices = true;
+        } else if (std::strcmp(argv[i], "--check-arena") == 0) {
+            options.CheckArena = true;
+        } else if (std::strcmp(argv[i], "--cull") == 0 && hasValue) {
+            options.InstanceCounts = ParseList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--vertices") == 0 && hasValue) {
+            options.VertexCounts = ParseList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--surfaces") == 0 && hasValue) {
+            options.SurfaceCounts = ParseList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && hasValue) {
+            options.ThreadCounts = ParseList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--repeats") == 0 && hasValue) {
+            options.Repeats = std::max<SizeType>(std::atoi(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--simd") == 0 && hasValue) {
+            isValid = ParseLevel(argv[++i]);
+        } else {
+            isValid = false;
+        }
+    }
+
+    if (!isValid || options.VertexCounts.empty() ||
+        options.SurfaceCounts.empty()) {
+        std::fprintf(stderr,
+                     "usage: %s [--vertices N,...] [--surfaces N,...] "
+                     "[--threads N,...] [--repeats N] "
+                     "[--simd scalar|sse|avx] [--json] [--deviation] "
+                     "[--check-slices] [--check-arena] [--cull N,...]\n",
+                     argv[0]);
+        return false;
+    }
+
+    if (options.ThreadCounts.empty()) {
+        options.ThreadCounts.push_back(1);
+        const auto hardware = std::thread::hardware_concurrency();
+        if (hardware > 1) {
+            options.ThreadCounts.push_back(hardware);
+        }
+    }
+    return true;
+}
+
+Mat4x4 GenerateRotateMatrix() {
+    // tilted towards the viewer, so culling keeps a realistic share
+    Mat4x4 matrix = Mat4x4::Identity();
+    matrix(1, 1) = std::cos(ANGLE);
+    matrix(1, 2) = std::sin(ANGLE);
+    matrix(2, 1) = -std::sin(ANGLE);
+    matrix(2, 2) = std::cos(ANGLE);
+    return matrix;
+}
+
+Result Measure(const std::string& name,
+               SizeType vertexCount,
+               SizeType surfaceCount,
+               SizeType threads,
+               SizeType repeats,
+               const Case& function) {
+    using Clock = std::chrono::steady_clock;
+
+    // warm up caches, the pool and the allocator
+    SizeType vertices = function();
+
+    std::vector<double> times;
+    times.reserve(repeats);
+    const auto allocations = AllocationCount.load();
+    const auto bytes = AllocatedBytes.load();
+    for (auto i = 0UL; i < repeats; i++) {
+        const auto start = Clock::now();
+        vertices = function();
+        const auto stop = Clock::now();
+        times.push_back(
+            std::chrono::duration<double, std::nano>(stop - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    return {name,
+            vertexCount,
+            surfaceCount,
+            threads,
+            vertices,
+            times.front(),
+            times[times.size() / 2],
+            1.0 * (AllocationCount - allocations) / repeats,
+            1.0 * (AllocatedBytes - bytes) / repeats};
+}
+
+std::vector<Result> RunGrid(SizeType vertexCount,
+                            SizeType surfaceCount,
+                            const Options& options) {
+    const Mat4x4 rotateMatrix = GenerateRotateMatrix();
+    const Lighting lighting = {0.5f, 0.5f, 0.5f, Vec3(1, 0, 0), Vec3(0, 0, 1)};
+    const Ellipsoid ellipsoid = {A, B, C, vertexCount, surfaceCount,
+                                 Vec3(0, 0, 1)};
+    const ObjectMesh mesh = ellipsoid.GenerateObjectMesh();
+    const auto repeats = options.Repeats;
+
+    std::vector<Result> results;
+
+    // single threaded parts of the pipeline
+    results.push_back(
+        Measure("object_mesh", vertexCount, surfaceCount, 1, repeats, [&]() {
+            auto objectMesh = ellipsoid.GenerateObjectMesh();
+            return objectMesh.GetRingCount() * objectMesh.GetRingSize();
+        }));
+    // slider steps between n and 2 * n vertices: every other point of
+    // the larger ring is copied, the smaller ring is copied whole
+    TessellationCache cache;
+    Ellipsoid resized = ellipsoid;
+    bool isDoubled = false;
+    results.push_back(Measure(
+        "retessellate", vertexCount, surfaceCount, 1, repeats, [&]() {
+            isDoubled = !isDoubled;
+            resized.SetVertexCount(isDoubled ? 2 * vertexCount : vertexCount);
+            auto objectMesh = resized.GenerateObjectMesh(cache);
+            return objectMesh.GetRingCount() * objectMesh.GetRingSize();
+        }));
+    results.push_back(
+        Measure("side_layers", vertexCount, surfaceCount, 1, repeats, [&]() {
+            SizeType count = 0;
+            for (auto k = 0UL; k + 1 < mesh.GetRingCount(); k++) {
+                Layer layer(mesh, k, Layer::LayerType::SIDE, Vec3(0, 0, 1),
+                            lighting);
+                count += layer.GetItemsCount();
+            }
+            return count;
+        }));
+    results.push_back(
+        Measure("lighting", vertexCount, surfaceCount, 1, repeats, [&]() {
+            const auto color = Vec3(0, 0, 1);
+            float sum = 0;
+            for (auto k = 0UL; k < mesh.GetRingCount(); k++) {
+                for (auto i = 0UL; i < mesh.GetRingSize(); i++) {
+                    const auto& point = mesh.GetPoint(k, i);
+                    const auto& normal = mesh.GetNormal(k, i);
+                    sum += lighting.Calculate(
+                        Vec3(point[0], point[1], point[2]),
+                        Vec3(normal[0], normal[1], normal[2]), color)[2];
+                }
+            }
+            // keeps the loop from being optimized away
+            volatile float sink = sum;
+            (void)sink;
+            return mesh.GetRingCount() * mesh.GetRingSize();
+        }));
+    // the same points a ring at a time
+    std::vector<float> intensities(mesh.GetRingSize());
+    results.push_back(Measure(
+        "batch_light", vertexCount, surfaceCount, 1, repeats, [&]() {
+            float sum = 0;
+            for (auto k = 0UL; k < mesh.GetRingCount(); k++) {
+                lighting.CalculateIntensities(
+                    mesh.GetPoint(k, 0).data(), 4, mesh.GetNormal(k, 0).data(),
+                    4, mesh.GetRingSize(), intensities.data());
+                sum += intensities.back();
+            }
+            volatile float sink = sum;
+            (void)sink;
+            return mesh.GetRingCount() * mesh.GetRingSize();
+        }));
+
+    // what the compact upload adds on top of the copy into the mapping
+    const auto packed = ellipsoid.GeneratePackedMesh(mesh, rotateMatrix,
+                                                     lighting);
+    std::vector<CompactVertex> compact(packed.GetVertexCount());
+    results.push_back(
+        Measure("compact", vertexCount, surfaceCount, 1, repeats, [&]() {
+            CompactVertex::Convert(packed.GetVertices(),
+                                   packed.GetVertexCount(), compact.data());
+            return packed.GetVertexCount();
+        }));
+
+    // whole meshes, spread over the pool
+    for (auto threads : options.ThreadCounts) {
+        ThreadPool::SetInstanceThreadCount(threads);
+
+        results.push_back(Measure(
+            "triangles", vertexCount, surfaceCount, threads, repeats, [&]() {
+                auto layers =
+                    ellipsoid.GenerateVertices(mesh, rotateMatrix, lighting);
+                SizeType count = 0;
+                for (auto&& layer : layers) {
+                    count += layer.GetItemsCount();
+                }
+                return count;
+            }));
+        // the previous mesh is dropped before the next build, like the
+        // widget does once a rebuild has been uploaded
+        VertexArena arena;
+        results.push_back(Measure(
+            "packed", vertexCount, surfaceCount, threads, repeats, [&]() {
+                auto packed = ellipsoid.GeneratePackedMesh(
+                    mesh, rotateMatrix, lighting, ShadingMode::CPU,
+                    CullingMode::CPU, NormalMode::FACE, &arena);
+                return packed.GetVertexCount();
+            }));
+        // gradient normals per vertex instead of one per triangle
+        results.push_back(Measure(
+            "analytic", vertexCount, surfaceCount, threads, repeats, [&]() {
+                auto packed = ellipsoid.GeneratePackedMesh(
+                    mesh, rotateMatrix, lighting, ShadingMode::CPU,
+                    CullingMode::CPU, NormalMode::ANALYTIC, &arena);
+                return packed.GetVertexCount();
+            }));
+        results.push_back(Measure(
+            "indexed", vertexCount, surfaceCount, threads, repeats, [&]() {
+                auto indexed =
+                    ellipsoid.GenerateIndexedMesh(mesh, rotateMatrix, lighting);
+                return indexed.GetVertices().size();
+            }));
+        // counts indices, about a third of what the triangle lists take
+        results.push_back(Measure(
+            "strips", vertexCount, surfaceCount, threads, repeats, [&]() {
+                auto strips = ellipsoid.GenerateIndexedMesh(
+                    mesh, rotateMatrix, lighting, ShadingMode::CPU,
+                    CullingMode::CPU, Topology::STRIP);
+                return strips.GetIndexCount();
+            }));
+
+        // round trip through the builder, flipping between two shapes
+        // that both stay cached
+        std::mutex mutex;
+        std::condition_variable ready;
+        MeshBuilder::ResultPointer built;
+        MeshBuilder builder([&](MeshBuilder::ResultPointer result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            built = std::move(result);
+            ready.notify_one();
+        });
+        Ellipsoid revisited = ellipsoid;
+        bool isOther = false;
+        auto revisit = [&]() {
+            isOther = !isOther;
+            revisited.SetVertexCount(vertexCount + isOther);
+            builder.Post({revisited, rotateMatrix, lighting, MeshMode::PACKED,
+                          ShadingMode::GPU, CullingMode::GPU});
+
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&built]() { return built != nullptr; });
+            return std::exchange(built, nullptr)
+                ->Data->Packed.GetVertexCount();
+        };
+        // Measure warms up one shape, this is the other
+        revisit();
+        results.push_back(Measure("revisit", vertexCount, surfaceCount,
+                                  threads, repeats, revisit));
+    }
+    return results;
+}
+
+void PrintText(const std::vector<Result>& results) {
+    std::printf("simd: %s\n", RingKernel::GetLevelName(RingKernel::GetLevel()));
+    std::printf("%-12s %8s %8s %7s %9s %12s %12s %9s %10s %8s %12s\n", "case",
+                "vertices", "surfaces", "threads", "produced", "best ns",
+                "median ns", "ns/vert", "Mvert/s", "allocs", "bytes");
+    for (auto&& result : results) {
+        const auto perVertex = result.BestNs / std::max<SizeType>(
+                                                   result.Vertices, 1);
+        std::printf(
+            "%-12s %8zu %8zu %7zu %9zu %12.0f %12.0f %9.2f %10.2f %8.0f "
+            "%12.0f\n",
+            result.Case.c_str(), result.VertexCount, result.SurfaceCount,
+            result.Threads, result.Vertices, result.BestNs, result.MedianNs,
+            perVertex, 1e3 / perVertex, result.Allocations, result.Bytes);
+    }
+}
+
+void PrintJson(const std::vector<Result>& results, const Options& options) {
+    std::printf("{\n  \"benchmark\": \"ellipsoid\",\n");
+    std::printf("  \"repeats\": %zu,\n", options.Repeats);
+    std::printf("  \"simd\": \"%s\",\n",
+                RingKernel::GetLevelName(RingKernel::GetLevel()));
+    std::printf("  \"hardware_threads\": %u,\n",
+                std::thread::hardware_concurrency());
+    std::printf("  \"results\": [\n");
+    for (auto i = 0UL; i < results.size(); i++) {
+        const auto& result = results[i];
+        const auto perVertex = result.BestNs / std::max<SizeType>(
+                                                   result.Vertices, 1);
+        std::printf(
+            "    {\"case\": \"%s\", \"vertex_count\": %zu, "
+            "\"surface_count\": %zu, \"threads\": %zu, \"vertices\": %zu, "
+            "\"best_ns\": %.0f, \"median_ns\": %.0f, "
+            "\"ns_per_vertex\": %.3f, \"vertices_per_second\": %.0f, "
+            "\"allocations\": %.1f, \"allocated_bytes\": %.0f}%s\n",
+            result.Case.c_str(), result.VertexCount, result.SurfaceCount,
+            result.Threads, result.Vertices, result.BestNs, result.MedianNs,
+            perVertex, 1e9 / perVertex, result.Allocations, result.Bytes,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+SizeType CountTriangles(const Ellipsoid& ellipsoid) {
+    const auto mesh = ellipsoid.GenerateObjectMesh();
+    // two per quad of every side layer, one per edge of both caps
+    return 2 * mesh.GetRingSize() * mesh.GetRingCount();
+}
+
+void PrintDeviation(const Options& options) {
+    std::printf("%8s %8s | %9s %12s | %9s %12s | %8s %9s\n", "vertices",
+                "surfaces", "uniform", "deviation", "adaptive", "deviation",
+                "matched", "triangles");
+    for (auto vertexCount : options.VertexCounts) {
+        for (auto surfaceCount : options.SurfaceCounts) {
+            Ellipsoid uniform = {A, B, C, vertexCount, surfaceCount,
+                                 Vec3(0, 0, 1)};
+            Ellipsoid adaptive = uniform;
+            adaptive.SetSlicingMode(SlicingMode::ADAPTIVE);
+
+            // fewest adaptive slices that are at least as accurate
+            const auto target = uniform.GetSliceDeviation();
+            Ellipsoid matched = adaptive;
+            for (SizeType count = 1; count <= surfaceCount; count++) {
+                matched.SetSurfaceCount(count);
+                if (matched.GetSliceDeviation() <= target) {
+                    break;
+                }
+            }
+
+            std::printf("%8zu %8zu | %9zu %12.3e | %9zu %12.3e | %8zu %9zu\n",
+                        vertexCount, surfaceCount, CountTriangles(uniform),
+                        target, CountTriangles(adaptive),
+                        adaptive.GetSliceDeviation(),
+                        CountTriangles(matched) / (2 * vertexCount) - 1,
+                        CountTriangles(matched));
+        }
+    }
+}
+
+// Every surface count gives exactly that many side layers plus two caps,
+// the caps sit on the layer bounds and a ring at the same fraction of
+// the height gets the same height for every count.
+bool CheckSlices(const Options& options) {
+    const auto maxCount = *std::max_element(options.SurfaceCounts.begin(),
+                                            options.SurfaceCounts.end());
+    const Mat4x4 rotateMatrix = GenerateRotateMatrix();
+    const Lighting lighting = {0.5f, 0.5f, 0.5f, Vec3(1, 0, 0), Vec3(0, 0, 1)};
+
+    SizeType failures = 0;
+    auto check = [&failures](bool isValid, const char* what, SizeType count,
+                             SlicingMode slicing) {
+        if (!isValid) {
+            failures++;
+            std::fprintf(stderr, "%s slicing, %zu surfaces: %s\n",
+                         slicing == SlicingMode::UNIFORM ? "uniform"
+                                                         : "adaptive",
+                         count, what);
+        }
+    };
+
+    for (auto slicing : {SlicingMode::UNIFORM, SlicingMode::ADAPTIVE}) {
+        std::map<Ellipsoid::RingKey, LenghtType> keyHeights;
+        for (SizeType count = 1; count <= maxCount; count++) {
+            Ellipsoid ellipsoid = {A, B, C, 4, count, Vec3(0, 0, 1)};
+            ellipsoid.SetSlicingMode(slicing);
+            const auto mesh = ellipsoid.GenerateObjectMesh();
+            const auto halfHeight = ellipsoid.GetHalfExtent()[2];
+
+            check(mesh.GetRingCount() == count + 1, "ring count", count,
+                  slicing);
+            check(mesh.GetHeight(0) == -halfHeight, "bottom cap", count,
+                  slicing);
+            check(mesh.GetHeight(mesh.GetRingCount() - 1) == halfHeight,
+                  "top cap", count, slicing);
+            for (auto k = 0UL; k < mesh.GetRingCount(); k++) {
+                if (k != 0) {
+                    check(mesh.GetHeight(k - 1) < mesh.GetHeight(k),
+                          "ring order", count, slicing);
+                }
+                const auto key = Ellipsoid::GetRingKey(k, count);
+                const auto found = keyHeights.emplace(key, mesh.GetHeight(k));
+                check(found.first->second == mesh.GetHeight(k),
+                      "ring height differs from other counts", count,
+                      slicing);
+            }
+
+            // nothing culled, so every layer is there
+            const auto layers = ellipsoid.GenerateVertices(
+                mesh, rotateMatrix, lighting, ShadingMode::GPU,
+                CullingMode::GPU);
+            check(layers.size() == count + 2, "layer count", count, slicing);
+        }
+    }
+
+    std::printf("checked surface counts 1..%zu: %zu failures\n", maxCount,
+                failures);
+    return failures == 0;
+}
+
+// Every build is a new shape that goes to the result cache, the last
+// result is held like the mesh on screen. Past the first two builds
+// the arena has to serve all of them from its two blocks.
+bool CheckArena(const Options& options) {
+    const auto vertexCount = options.VertexCounts.front();
+    const auto surfaceCount = options.SurfaceCounts.front();
+    const Mat4x4 rotateMatrix = GenerateRotateMatrix();
+    const Lighting lighting = {0.5f, 0.5f, 0.5f, Vec3(1, 0, 0), Vec3(0, 0, 1)};
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    MeshBuilder::ResultPointer built;
+    MeshBuilder builder([&](MeshBuilder::ResultPointer result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        built = std::move(result);
+        ready.notify_one();
+    });
+
+    MeshBuilder::ResultPointer shown;
+    SizeType warmAllocations = 0;
+    for (auto i = 0UL; i < ARENA_REBUILDS; i++) {
+        const Ellipsoid ellipsoid = {A + 0.01f * i, B, C, vertexCount,
+                                     surfaceCount, Vec3(0, 0, 1)};
+        builder.Post({ellipsoid, rotateMatrix, lighting, MeshMode::PACKED,
+                      ShadingMode::GPU, CullingMode::GPU});
+
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&built]() { return built != nullptr; });
+        shown = std::exchange(built, nullptr);
+        if (i == 1) {
+            warmAllocations = builder.GetArenaStats().Allocations;
+        }
+    }
+
+    const auto stats = builder.GetArenaStats();
+    const auto isFlat = stats.Allocations == warmAllocations;
+    std::printf("%zu rebuilds: %zu arena allocations after 2, %zu at the "
+                "end, %zu reuses, %zu cached\n",
+                ARENA_REBUILDS, warmAllocations, stats.Allocations,
+                stats.Reuses, builder.GetResultCacheStats().Entries);
+    if (!isFlat) {
+        std::fprintf(stderr, "arena allocates on every rebuild\n");
+    }
+    return isFlat;
+}
+
+double MedianNs(SizeType repeats, const std::function<void()>& function) {
+    using Clock = std::chrono::steady_clock;
+
+    function();
+    std::vector<double> times;
+    for (auto i = 0UL; i < repeats; i++) {
+        const auto start = Clock::now();
+        function();
+        const auto stop = Clock::now();
+        times.push_back(
+            std::chrono::duration<double, std::nano>(stop - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+bool PrintCulling(const Options& options) {
+    // the transform of the widget, zoomed in
+    Mat4x4 scaleMatrix = Mat4x4::Identity();
+    scaleMatrix(0, 0) = CULL_ZOOM;
+    scaleMatrix(1, 1) = CULL_ZOOM;
+    Mat4x4 projectionMatrix = Mat4x4::Identity();
+    projectionMatrix(2, 2) = -1;
+    const Mat4x4 transform =
+        GenerateRotateMatrix() * scaleMatrix * projectionMatrix;
+    const Frustum frustum(transform);
+
+    std::printf("%9s %10s %12s %12s %9s %9s %9s\n", "instances", "build ns",
+                "hierarchy ns", "linear ns", "visible", "culled", "tests");
+    SizeType failures = 0;
+    for (auto count : options.InstanceCounts) {
+        const auto scene = Scene::Generate(count, SCENE_RADIUS, 1);
+        std::vector<Instance> visible;
+        Scene::CullStats stats;
+
+        // the first cull after a change builds the hierarchy
+        const auto buildNs = MedianNs(options.Repeats, [&]() {
+            auto copy = scene;
+            copy.Cull(transform, visible);
+        });
+        const auto copyNs = MedianNs(options.Repeats, [&]() {
+            auto copy = scene;
+            visible.assign(copy.GetInstances().begin(),
+                           copy.GetInstances().begin() + 1);
+        });
+        auto indexed = scene;
+        const auto cullNs = MedianNs(options.Repeats, [&]() {
+            stats = indexed.Cull(transform, visible);
+        });
+
+        std::vector<Bounds> bounds;
+        for (auto&& instance : scene.GetInstances()) {
+            bounds.push_back(Scene::GetBounds(instance));
+        }
+        const auto& instances = scene.GetInstances();
+        const auto linearNs = MedianNs(options.Repeats, [&]() {
+            visible.clear();
+            for (auto i = 0UL; i < bounds.size(); i++) {
+                if (frustum.Classify(bounds[i]) != Frustum::Side::OUTSIDE) {
+                    visible.push_back(instances[i]);
+                }
+            }
+        });
+        const auto linearVisible = visible.size();
+
+        if (linearVisible != stats.Visible) {
+            failures++;
+            std::fprintf(stderr, "%zu instances: %zu visible, expected %zu\n",
+                         count, stats.Visible, linearVisible);
+        }
+        std::printf("%9zu %10.0f %12.0f %12.0f %9zu %9zu %9zu\n", count,
+                    buildNs - copyNs - cullNs, cullNs, linearNs, stats.Visible,
+                    stats.Culled, stats.Tests);
+    }
+    return failures == 0;
+}
+
+void* CountedAllocate(std::size_t size, std::size_t alignment) {
+    AllocationCount++;
+    AllocatedBytes += size;
+    void* pointer = nullptr;
+    alignment = std::max(alignment, sizeof(void*));
+    if (posix_memalign(&pointer, alignment, size == 0 ? 1 : size) == 0) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+}  // namespace
+
+// Every allocation of the process goes through here. The whole family
+// is replaced, so every pointer free gets comes from CountedAllocate.
+void* operator new(std::size_t size) {
+    return CountedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size) {
+    return CountedAllocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return CountedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer,
+                       std::size_t,
+                       std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    if (options.Deviation) {
+        PrintDeviation(options);
+        return 0;
+    }
+    if (options.CheckSlices) {
+        return CheckSlices(options) ? 0 : 1;
+    }
+    if (options.CheckArena) {
+        return CheckArena(options) ? 0 : 1;
+    }
+    if (!options.InstanceCounts.empty()) {
+        return PrintCulling(options) ? 0 : 1;
+    }
+
+    std::vector<Result> results;
+    for (auto vertexCount : options.VertexCounts) {
+        for (auto surfaceCount : options.SurfaceCounts) {
+            auto grid = RunGrid(vertexCount, surfaceCount, options);
+            results.insert(results.end(), grid.begin(), grid.end());
+        }
+    }
+
+    if (options.Json) {
+        PrintJson(results, options);
+    } else {
+        PrintText(results);
+    }
+    return 0;
+}
@@ -0,0 +1,533 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+// Headless benchmark of the frame path of MyOpenGLWidget. Renders into a
+// framebuffer object of an offscreen OpenGL 3.3 context through the same
+// MeshBuilder, MeshBuffer and shaders, so Mesa's llvmpipe is enough and
+// no window or GPU is needed.
+//
+// Usage: cg-lab03-render-bench [--vertices 20,100] [--surfaces 20,100]
+//                              [--frames 60] [--instances 1000]
+//                              [--budget NS] [--json]
+//
+// Every case renders the same sequence of angles for every tessellation.
+// A mesh is rebuilt for a frame only when the widget would rebuild it,
+// the build is reported apart from the frame, which is the upload, the
+// draw and glFinish. --budget fails the run if the median frame of any
+// case takes longer. QT_QPA_PLATFORM defaults to offscreen.
+
+#include <Ellipsoid.hpp>
+#include <MeshBuffer.hpp>
+#include <MeshBuilder.hpp>
+#include <Scene.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QSurfaceFormat>
+
+namespace {
+
+struct Options {
+    std::vector<SizeType> VertexCounts = {20, 100};
+    std::vector<SizeType> SurfaceCounts = {20, 100};
+    SizeType Frames = 60;
+    SizeType InstanceCount = 1000;
+    // no limit if 0
+    double BudgetNs = 0;
+    bool Json = false;
+};
+
+struct Case {
+    const char* Name;
+    MeshMode Mode;
+    ShadingMode Shading;
+    CullingMode Culling;
+    SceneMode Objects;
+};
+
+struct Result {
+    std::string Case;
+    SizeType VertexCount;
+    SizeType SurfaceCount;
+    SizeType Frames;
+    double MedianNs;
+    double WorstNs;
+    double BuildNs;
+    double UploadBytes;
+    double DrawCalls;
+};
+
+// widget defaults, see MyOpenGLWidget and MyMainWindow
+const LenghtType A = 1.1f;
+const LenghtType B = 1.5f;
+const LenghtType C = 0.2f;
+const int WIDTH = 350;
+const int HEIGHT = 350;
+const float IMAGE_SIZE = 300;
+const float SCALE_FACTOR = 3;
+const float SCENE_RADIUS = 0.5f;
+const Vec3 VIEW_POINT = Vec3(0, 0, 1);
+const Vec3 LIGHT_POSITION = Vec3(1, 0, 0);
+const Vec3 TO_OBSERVER = Vec3(0, 0, 1);
+const float LIGHT_COEFF = 0.5f;
+const float PI = 4 * std::atan(1.0f);
+
+const Case CASES[] = {
+    {"triangles", MeshMode::TRIANGLES, ShadingMode::CPU, CullingMode::CPU,
+     SceneMode::SINGLE},
+    {"packed", MeshMode::PACKED, ShadingMode::CPU, CullingMode::CPU,
+     SceneMode::SINGLE},
+    {"indexed", MeshMode::INDEXED, ShadingMode::CPU, CullingMode::CPU,
+     SceneMode::SINGLE},
+    {"strips", MeshMode::STRIPS, ShadingMode::CPU, CullingMode::CPU,
+     SceneMode::SINGLE},
+    {"packed_gpu", MeshMode::PACKED, ShadingMode::GPU, CullingMode::GPU,
+     SceneMode::SINGLE},
+    {"strips_gpu", MeshMode::STRIPS, ShadingMode::GPU, CullingMode::GPU,
+     SceneMode::SINGLE},
+    {"instanced", MeshMode::STRIPS, ShadingMode::GPU, CullingMode::GPU,
+     SceneMode::INSTANCED},
+};
+
+std::vector<SizeType> ParseList(const char* text) {
+    std::vector<SizeType> values;
+    for (auto begin = text; *begin != '\0';) {
+        char* end = nullptr;
+        const auto value = std::strtoul(begin, &end, 10);
+        if (end == begin) {
+            break;
+        }
+        values.push_back(value);
+        begin = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    auto isValid = true;
+    for (auto i = 1; i < argc && isValid; i++) {
+        const bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--json") == 0) {
+            options.Json = true;
+        } else if (std::strcmp(argv[i], "--vertices") == 0 && hasValue) {
+            options.VertexCounts = ParseList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--surfaces") == 0 && hasValue) {
+            options.SurfaceCounts = ParseList(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.Frames = std::max<SizeType>(std::atoi(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--instances") == 0 && hasValue) {
+            options.InstanceCount = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--budget") == 0 && hasValue) {
+            options.BudgetNs = std::atof(argv[++i]);
+        } else {
+            isValid = false;
+        }
+    }
+
+    if (!isValid || options.VertexCounts.empty() ||
+        options.SurfaceCounts.empty()) {
+        std::fprintf(stderr,
+                     "usage: %s [--vertices N,...] [--surfaces N,...] "
+                     "[--frames N] [--instances N] [--budget NS] [--json]\n",
+                     argv[0]);
+        return false;
+    }
+    return true;
+}
+
+// the rotations of MyOpenGLWidget about OX, then OY
+Mat4x4 GenerateRotateMatrix(float angle) {
+    const auto angleOY = angle / 2;
+    Mat4x4 rotateOX = Mat4x4::Identity();
+    rotateOX(1, 1) = std::cos(angle);
+    rotateOX(1, 2) = std::sin(angle);
+    rotateOX(2, 1) = -std::sin(angle);
+    rotateOX(2, 2) = std::cos(angle);
+    Mat4x4 rotateOY = Mat4x4::Identity();
+    rotateOY(0, 0) = std::cos(angleOY);
+    rotateOY(0, 2) = -std::sin(angleOY);
+    rotateOY(2, 0) = std::sin(angleOY);
+    rotateOY(2, 2) = std::cos(angleOY);
+    return rotateOX * rotateOY;
+}
+
+Mat4x4 GenerateTransformMatrix(const Mat4x4& rotateMatrix) {
+    Mat4x4 scaleMatrix = Mat4x4::Identity();
+    scaleMatrix(0, 0) = IMAGE_SIZE / WIDTH * SCALE_FACTOR;
+    scaleMatrix(1, 1) = IMAGE_SIZE / HEIGHT * SCALE_FACTOR;
+    Mat4x4 projectionMatrix = Mat4x4::Identity();
+    projectionMatrix(2, 2) = -1;
+    return rotateMatrix * scaleMatrix * projectionMatrix;
+}
+
+QOpenGLShaderProgram* CreateShaderProgram(const char* vertexShader,
+                                          const char* fragmentShader) {
+    auto program = new QOpenGLShaderProgram;
+    program->addShaderFromSourceFile(QOpenGLShader::Vertex, vertexShader);
+    program->addShaderFromSourceFile(QOpenGLShader::Fragment, fragmentShader);
+
+    program->bindAttributeLocation("position", MeshBuffer::POSITION_LOCATION);
+    program->bindAttributeLocation("color", MeshBuffer::COLOR_LOCATION);
+    program->bindAttributeLocation("normal", MeshBuffer::NORMAL_LOCATION);
+    program->bindAttributeLocation("instancePosition",
+                                   MeshBuffer::INSTANCE_POSITION_LOCATION);
+    program->bindAttributeLocation("instanceAxes",
+                                   MeshBuffer::INSTANCE_AXES_LOCATION);
+    program->bindAttributeLocation("instanceRotation",
+                                   MeshBuffer::INSTANCE_ROTATION_LOCATION);
+    program->bindAttributeLocation("instanceColor",
+                                   MeshBuffer::INSTANCE_COLOR_LOCATION);
+
+    if (!program->link()) {
+        std::fprintf(stderr, "cannot link %s: %s\n", vertexShader,
+                     program->log().toLocal8Bit().constData());
+        delete program;
+        return nullptr;
+    }
+    return program;
+}
+
+void SetUniformMatrix(QOpenGLShaderProgram* program,
+                      const char* name,
+                      const Mat4x4& matrix) {
+    // QMatrix4x4 takes row-major data, Eigen stores columns
+    const Eigen::Matrix<float, 4, 4, Eigen::RowMajor> rowMajor = matrix;
+    program->setUniformValue(name, QMatrix4x4(rowMajor.data()));
+}
+
+void SetLightingUniforms(QOpenGLShaderProgram* program,
+                         const Mat4x4& rotateMatrix) {
+    SetUniformMatrix(program, "rotateMatrix", rotateMatrix);
+    program->setUniformValue("ambientCoeff", LIGHT_COEFF);
+    program->setUniformValue("specularCoeff", LIGHT_COEFF);
+    program->setUniformValue("diffuseCoeff", LIGHT_COEFF);
+    program->setUniformValue("shineCoeff",
+                             static_cast<GLfloat>(Lighting::SHINE_COEFF));
+    program->setUniformValue("light", LIGHT_POSITION[0], LIGHT_POSITION[1],
+                             LIGHT_POSITION[2]);
+    program->setUniformValue("toObserver", TO_OBSERVER[0], TO_OBSERVER[1],
+                             TO_OBSERVER[2]);
+}
+
+// MeshBuilder reports on its own thread, the frames wait for it
+class MeshWaiter {
+public:
+    MeshWaiter()
+        : Builder{[this](MeshBuilder::ResultPointer result) {
+              std::lock_guard<std::mutex> lock(Mutex);
+              Latest = std::move(result);
+              Ready.notify_one();
+          }} {}
+
+    MeshBuilder::DataPointer Build(const MeshRequest& request) {
+        const auto id = Builder.Post(request);
+        std::unique_lock<std::mutex> lock(Mutex);
+        Ready.wait(lock, [this, id]() { return Latest && Latest->Id == id; });
+        return Latest->Data;
+    }
+
+private:
+    std::mutex Mutex;
+    std::condition_variable Ready;
+    MeshBuilder::ResultPointer Latest;
+    // last, so it stops reporting before the rest goes away
+    MeshBuilder Builder;
+};
+
+class Renderer {
+public:
+    explicit Renderer(QOpenGLFunctions* functions)
+        : Functions{functions},
+          ShaderProgram{CreateShaderProgram(":/shaders/vertexShader.glsl",
+                                            ":/shaders/fragmentShader.glsl")},
+          LightingProgram{
+              CreateShaderProgram(":/shaders/lightingVertexShader.glsl",
+                                  ":/shaders/lightingFragmentShader.glsl")},
+          InstanceProgram{
+              CreateShaderProgram(":/shaders/instanceVertexShader.glsl",
+                                  ":/shaders/lightingFragmentShader.glsl")} {}
+
+    ~Renderer() {
+        delete ShaderProgram;
+        delete LightingProgram;
+        delete InstanceProgram;
+    }
+
+    bool IsValid() const {
+        return ShaderProgram != nullptr && LightingProgram != nullptr &&
+               InstanceProgram != nullptr;
+    }
+
+    Result Run(const Case& renderCase,
+               SizeType vertexCount,
+               SizeType surfaceCount,
+               const Options& options);
+
+private:
+    QOpenGLShaderProgram* GetProgram(const Case& renderCase) const {
+        if (renderCase.Objects == SceneMode::INSTANCED) {
+            return InstanceProgram;
+        }
+        return renderCase.Shading == ShadingMode::GPU ? LightingProgram
+                                                      : ShaderProgram;
+    }
+
+    QOpenGLFunctions* Functions;
+    QOpenGLShaderProgram* ShaderProgram;
+    QOpenGLShaderProgram* LightingProgram;
+    QOpenGLShaderProgram* InstanceProgram;
+    MeshWaiter Waiter;
+};
+
+// the steps of MyOpenGLWidget::paintGL, finished before the clock stops
+Result Renderer::Run(const Case& renderCase,
+                     SizeType vertexCount,
+                     SizeType surfaceCount,
+                     const Options& options) {
+    const bool isInstanced = renderCase.Objects == SceneMode::INSTANCED;
+    const auto object =
+        isInstanced
+            ? Scene::GetUnitEllipsoid(vertexCount, surfaceCount, VIEW_POINT)
+            : Ellipsoid(A, B, C, vertexCount, surfaceCount, VIEW_POINT);
+    auto scene = Scene::Generate(isInstanced ? options.InstanceCount : 0,
+                                 SCENE_RADIUS, 0);
+    std::vector<Instance> visible;
+    const Lighting lighting = {LIGHT_COEFF, LIGHT_COEFF, LIGHT_COEFF,
+                               LIGHT_POSITION, TO_OBSERVER};
+
+    auto program = GetProgram(renderCase);
+    MeshBuffer mesh;
+    mesh.Create(program);
+
+    std::vector<double> frameTimes;
+    std::vector<double> buildTimes;
+    SizeType uploadedBytes = 0;
+    SizeType drawCalls = 0;
+    MeshBuilder::DataPointer data;
+    MeshBuffer::GenerationType generation = 0;
+    QElapsedTimer timer;
+    // frame 0 warms up and isn't counted
+    for (auto frame = 0UL; frame <= options.Frames; frame++) {
+        const auto angle = 2 * PI * frame / options.Frames;
+        const Mat4x4 rotateMatrix = GenerateRotateMatrix(angle);
+        const Mat4x4 transformMatrix = GenerateTransformMatrix(rotateMatrix);
+
+        const MeshRequest request = {object,
+                                     rotateMatrix,
+                                     lighting,
+                                     renderCase.Mode,
+                                     renderCase.Shading,
+                                     renderCase.Culling};
+        if (data == nullptr || request.DependsOnView()) {
+            timer.start();
+            data = Waiter.Build(request);
+            generation++;
+            if (frame != 0) {
+                buildTimes.push_back(timer.nsecsElapsed());
+            }
+        }
+
+        const auto bytesBefore = mesh.GetUploadedBytes();
+        timer.start();
+        program->bind();
+        Functions->glViewport(0, 0, WIDTH, HEIGHT);
+        Functions->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+                           GL_STENCIL_BUFFER_BIT);
+        if (renderCase.Culling == CullingMode::GPU) {
+            Functions->glEnable(GL_DEPTH_TEST);
+            Functions->glEnable(GL_CULL_FACE);
+            Functions->glCullFace(GL_BACK);
+            Functions->glFrontFace(GL_CCW);
+        } else {
+            Functions->glDisable(GL_DEPTH_TEST);
+            Functions->glDisable(GL_CULL_FACE);
+        }
+        SetUniformMatrix(program, "transformMatrix", transformMatrix);
+        if (renderCase.Shading == ShadingMode::GPU) {
+            SetLightingUniforms(program, rotateMatrix);
+        }
+        if (isInstanced) {
+            const Vec3 scale = Scene::GetUnitScale();
+            program->setUniformValue("meshScale", scale[0], scale[1],
+                                     scale[2]);
+        }
+
+        if (renderCase.Mode == MeshMode::INDEXED ||
+            renderCase.Mode == MeshMode::STRIPS) {
+            mesh.Upload(data->Indexed, generation);
+        } else if (renderCase.Mode == MeshMode::PACKED) {
+            mesh.Upload(data->Packed, generation);
+        } else {
+            mesh.Upload(data->Layers, generation);
+        }
+        if (isInstanced) {
+            // the view changes every frame
+            scene.Cull(transformMatrix, visible);
+            mesh.UploadInstances(visible, frame + 1);
+        }
+        mesh.Bind();
+        if (isInstanced) {
+            mesh.DrawInstanced();
+        } else {
+            mesh.Draw();
+        }
+        mesh.Release();
+        program->release();
+        Functions->glFinish();
+
+        if (frame != 0) {
+            frameTimes.push_back(timer.nsecsElapsed());
+            uploadedBytes += mesh.GetUploadedBytes() - bytesBefore;
+            drawCalls += mesh.GetDrawCallCount();
+        }
+    }
+    mesh.Destroy();
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+    std::sort(buildTimes.begin(), buildTimes.end());
+    const auto frames = frameTimes.size();
+    return {renderCase.Name,
+            vertexCount,
+            surfaceCount,
+            frames,
+            frameTimes[frames / 2],
+            frameTimes.back(),
+            buildTimes.empty() ? 0 : buildTimes[buildTimes.size() / 2],
+            1.0 * uploadedBytes / frames,
+            1.0 * drawCalls / frames};
+}
+
+void PrintText(const std::vector<Result>& results, const char* renderer) {
+    std::printf("renderer: %s\n", renderer);
+    std::printf("%-12s %8s %8s %6s %12s %12s %12s %12s %6s\n", "case",
+                "vertices", "surfaces", "frames", "median ns", "worst ns",
+                "build ns", "upload B", "draws");
+    for (auto&& result : results) {
+        std::printf("%-12s %8zu %8zu %6zu %12.0f %12.0f %12.0f %12.0f %6.1f\n",
+                    result.Case.c_str(), result.VertexCount,
+                    result.SurfaceCount, result.Frames, result.MedianNs,
+                    result.WorstNs, result.BuildNs, result.UploadBytes,
+                    result.DrawCalls);
+    }
+}
+
+void PrintJson(const std::vector<Result>& results,
+               const Options& options,
+               const char* renderer) {
+    std::printf("{\n  \"benchmark\": \"render\",\n");
+    std::printf("  \"renderer\": \"%s\",\n", renderer);
+    std::printf("  \"frames\": %zu,\n", options.Frames);
+    std::printf("  \"instances\": %zu,\n", options.InstanceCount);
+    std::printf("  \"results\": [\n");
+    for (auto i = 0UL; i < results.size(); i++) {
+        const auto& result = results[i];
+        std::printf(
+            "    {\"case\": \"%s\", \"vertex_count\": %zu, "
+            "\"surface_count\": %zu, \"median_frame_ns\": %.0f, "
+            "\"worst_frame_ns\": %.0f, \"median_build_ns\": %.0f, "
+            "\"uploaded_bytes_per_frame\": %.0f, "
+            "\"draw_calls_per_frame\": %.2f}%s\n",
+            result.Case.c_str(), result.VertexCount, result.SurfaceCount,
+            result.MedianNs, result.WorstNs, result.BuildNs,
+            result.UploadBytes, result.DrawCalls,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    // no display needed, Mesa falls back to llvmpipe without a GPU
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication application(argc, argv);
+    Q_INIT_RESOURCE(resources);
+
+    QSurfaceFormat format;
+    format.setDepthBufferSize(24);
+    format.setStencilBufferSize(8);
+    format.setRenderableType(QSurfaceFormat::OpenGL);
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+    if (!context.create() || !surface.isValid() ||
+        !context.makeCurrent(&surface)) {
+        std::fprintf(stderr, "cannot create an OpenGL 3.3 context\n");
+        return 1;
+    }
+
+    auto functions = context.functions();
+    const auto rendererName = std::string(reinterpret_cast<const char*>(
+        functions->glGetString(GL_RENDERER)));
+    std::vector<Result> results;
+    auto isWithinBudget = true;
+    {
+        QOpenGLFramebufferObject target(
+            WIDTH, HEIGHT, QOpenGLFramebufferObject::CombinedDepthStencil);
+        target.bind();
+        functions->glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+        Renderer renderer(functions);
+        if (!renderer.IsValid()) {
+            return 1;
+        }
+        for (auto&& renderCase : CASES) {
+            if (renderCase.Objects == SceneMode::INSTANCED &&
+                options.InstanceCount == 0) {
+                continue;
+            }
+            for (auto vertexCount : options.VertexCounts) {
+                for (auto surfaceCount : options.SurfaceCounts) {
+                    results.push_back(renderer.Run(renderCase, vertexCount,
+                                                   surfaceCount, options));
+                    if (options.BudgetNs > 0 &&
+                        results.back().MedianNs > options.BudgetNs) {
+                        isWithinBudget = false;
+                    }
+                }
+            }
+        }
+        target.release();
+    }
+    context.doneCurrent();
+
+    if (options.Json) {
+        PrintJson(results, options, rendererName.c_str());
+    } else {
+        PrintText(results, rendererName.c_str());
+    }
+    if (!isWithinBudget) {
+        std::fprintf(stderr, "median frame over the budget of %.0f ns\n",
+                     options.BudgetNs);
+    }
+    return isWithinBudget ? 0 : 1;
+}
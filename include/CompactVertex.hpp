@@ -0,0 +1,125 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_COMPACTVERTEX_HPP_
+#define CG_LAB_COMPACTVERTEX_HPP_
+
+#include <Vertex.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Vertex as it is uploaded in the compact format: xyz position in
+// floats, xyz normal packed 10:10:10:2 as signed normalized integers
+// and rgba color as unsigned normalized bytes. 20 bytes against 48.
+class CompactVertex {
+public:
+    using FloatType = Vertex::FloatType;
+    using IntType = Vertex::IntType;
+    using Vec4 = Vertex::Vec4;
+
+    CompactVertex() = default;
+    explicit CompactVertex(const Vertex& vertex) noexcept {
+        const auto position = vertex.GetPositionData();
+        const auto color = vertex.GetColorData();
+        const auto normal = vertex.GetNormalData();
+        for (auto i = 0; i < POSITION_TUPLE_SIZE; i++) {
+            Position[i] = position[i];
+        }
+        for (auto i = 0; i < COLOR_TUPLE_SIZE; i++) {
+            Color[i] = ToUnsignedByte(color[i]);
+        }
+        Normal = ToSigned10(normal[0]) | ToSigned10(normal[1]) << 10 |
+                 ToSigned10(normal[2]) << 20;
+    }
+
+    // decoded the way the GL does it, for checking the precision
+    Vec4 GetPosition() const noexcept {
+        return Vec4(Position[0], Position[1], Position[2], 1);
+    }
+    Vec4 GetColor() const noexcept {
+        return Vec4(Color[0], Color[1], Color[2], Color[3]) / BYTE_MAX;
+    }
+    Vec4 GetNormal() const noexcept {
+        return Vec4(FromSigned10(Normal), FromSigned10(Normal >> 10),
+                    FromSigned10(Normal >> 20), 0);
+    }
+
+    static constexpr IntType GetPositionTupleSize() noexcept {
+        return POSITION_TUPLE_SIZE;
+    }
+
+    static constexpr IntType GetColorTupleSize() noexcept {
+        return COLOR_TUPLE_SIZE;
+    }
+
+    // packed formats are read as four components, w is ignored
+    static constexpr IntType GetNormalTupleSize() noexcept {
+        return NORMAL_TUPLE_SIZE;
+    }
+
+    static constexpr IntType GetPositionOffset() noexcept {
+        return offsetof(CompactVertex, Position);
+    }
+
+    static constexpr IntType GetColorOffset() noexcept {
+        return offsetof(CompactVertex, Color);
+    }
+
+    static constexpr IntType GetNormalOffset() noexcept {
+        return offsetof(CompactVertex, Normal);
+    }
+
+    static constexpr IntType GetStride() noexcept {
+        return sizeof(CompactVertex);
+    }
+
+    static void Convert(const Vertex* vertices,
+                        std::size_t count,
+                        CompactVertex* result) noexcept {
+        for (auto i = 0UL; i < count; i++) {
+            result[i] = CompactVertex(vertices[i]);
+        }
+    }
+
+private:
+    static const IntType POSITION_TUPLE_SIZE = 3;
+    static const IntType COLOR_TUPLE_SIZE = 4;
+    static const IntType NORMAL_TUPLE_SIZE = 4;
+    static constexpr FloatType BYTE_MAX = 255;
+    static constexpr FloatType SIGNED_10_MAX = 511;
+    static constexpr std::uint32_t MASK_10 = 0x3ff;
+
+    // rounds by truncating value + 0.5, std::lround is a library call
+    // and made the conversion several times slower
+    static std::uint8_t ToUnsignedByte(FloatType value) noexcept {
+        value = std::min<FloatType>(std::max<FloatType>(value, 0), 1);
+        return static_cast<std::uint8_t>(value * BYTE_MAX + 0.5f);
+    }
+
+    // two's complement in the low 10 bits
+    static std::uint32_t ToSigned10(FloatType value) noexcept {
+        value = std::min<FloatType>(std::max<FloatType>(value, -1), 1);
+        const auto integer = static_cast<IntType>(
+            value * SIGNED_10_MAX + (value < 0 ? -0.5f : 0.5f));
+        return static_cast<std::uint32_t>(integer) & MASK_10;
+    }
+
+    static FloatType FromSigned10(std::uint32_t bits) noexcept {
+        bits &= MASK_10;
+        const auto integer = bits & 0x200 ? static_cast<IntType>(bits) - 0x400
+                                          : static_cast<IntType>(bits);
+        return std::max<FloatType>(integer / SIGNED_10_MAX, -1);
+    }
+
+    FloatType Position[3];
+    std::uint32_t Normal;
+    std::uint8_t Color[4];
+};
+
+static_assert(sizeof(CompactVertex) == 20, "compact vertex is padded");
+
+#endif  // CG_LAB_COMPACTVERTEX_HPP_
@@ -6,9 +6,17 @@
 #ifndef CG_LAB_ELLIPSOID_HPP_
 #define CG_LAB_ELLIPSOID_HPP_
 
+#include <RingKernel.hpp>
 #include <Vertex.hpp>
+#include <VertexArena.hpp>
 
+#include <algorithm>
 #include <cstdint>
+#include <limits>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifdef EIGEN3_INCLUDE_DIR
@@ -25,96 +33,401 @@ using Map4x4 = Eigen::Map<Eigen::Matrix<float, 4, 4, Eigen::RowMajor>>;
 using SizeType = std::size_t;
 using LenghtType = float;
 using VertexVector = std::vector<Vertex>;
+using IndexType = std::uint32_t;
+using IndexVector = std::vector<IndexType>;
+
+// ends a triangle strip in STRIP index lists
+constexpr IndexType RESTART_INDEX = std::numeric_limits<IndexType>::max();
+
+// CPU bakes lighting into vertex colors, GPU leaves it to the shader
+enum class ShadingMode { CPU, GPU };
+// CPU drops faces turned away from the viewer, GPU emits the closed
+// surface and leaves it to the depth test and face culling
+enum class CullingMode { CPU, GPU };
+// UNIFORM spaces slices evenly in height, ADAPTIVE packs them where
+// the profile bends most, for the same chord error on every slice
+enum class SlicingMode { UNIFORM, ADAPTIVE };
+// FACE lights and culls every side triangle by its own normal, ANALYTIC
+// takes the ellipsoid gradient at the ring vertices, shared by every
+// triangle around them, for smooth shading. Caps are flat either way.
+enum class NormalMode { FACE, ANALYTIC };
+// TRIANGLES takes three indices per triangle, STRIP runs triangle
+// strips each closed by RESTART_INDEX
+enum class Topology { TRIANGLES, STRIP };
+
+// A, B, C, vertex count, surface count and slicing
+using ShapeKey = std::tuple<LenghtType,
+                            LenghtType,
+                            LenghtType,
+                            SizeType,
+                            SizeType,
+                            SlicingMode>;
 
 class Lighting {
 public:
+    // default specular exponent, larger ones are clamped to the maximum
+    static constexpr unsigned SHINE_COEFF = 10;
+    static constexpr unsigned MAX_SHINE_COEFF = 128;
+
     Lighting(float ambientCoeff,
              float specularCoeff,
              float diffuseCoeff,
              const Vec3& light,
-             const Vec3& toObserverVec)
+             const Vec3& toObserverVec,
+             unsigned shineCoeff = SHINE_COEFF)
         : AmbientCoeff{ambientCoeff},
           SpecularCoeff{specularCoeff},
           DiffuseCoeff{diffuseCoeff},
+          ShineCoeff{std::min(shineCoeff, MAX_SHINE_COEFF)},
           Light{light},
           ToObserverVec{toObserverVec} {}
 
     Vec4 Calculate(const Vec3& point,
                    const Vec3& normal,
                    const Vec3& color) const;
+    // Calculate is this factor times the color
+    float CalculateIntensity(const Vec3& point, const Vec3& normal) const;
+    // CalculateIntensity of count points at once. Points and normals are
+    // xyz triples every stride floats apart, a normal stride of 0 shares
+    // the one normal between all points.
+    void CalculateIntensities(const float* points,
+                              SizeType pointStride,
+                              const float* normals,
+                              SizeType normalStride,
+                              SizeType count,
+                              float* result) const;
+
+    // same lighting seen from the rotated object's own coordinates
+    Lighting ToObjectSpace(const Mat4x4& rotateMatrix) const;
+
+    float GetAmbientCoeff() const { return AmbientCoeff; }
+    float GetSpecularCoeff() const { return SpecularCoeff; }
+    float GetDiffuseCoeff() const { return DiffuseCoeff; }
+    unsigned GetShineCoeff() const { return ShineCoeff; }
+    const Vec3& GetLight() const { return Light; }
+    const Vec3& GetToObserverVec() const { return ToObserverVec; }
 
 private:
+    using IntensityFunction = void (Lighting::*)(const float*,
+                                                 SizeType,
+                                                 const float*,
+                                                 SizeType,
+                                                 SizeType,
+                                                 float*) const;
+
+    // base to the power of Exponent, unrolled into multiplications
+    template <unsigned Exponent>
+    static float Power(float base);
+    // one instance per exponent, picked through a table
+    template <unsigned ShineExponent>
+    void BatchIntensities(const float* points,
+                          SizeType pointStride,
+                          const float* normals,
+                          SizeType normalStride,
+                          SizeType count,
+                          float* result) const;
+    template <unsigned... Exponents>
+    static const IntensityFunction* GetIntensityFunctions(
+        std::integer_sequence<unsigned, Exponents...>);
+
     float AmbientCoeff;
     float SpecularCoeff;
     float DiffuseCoeff;
+    unsigned ShineCoeff;
 
     Vec3 Light;
     Vec3 ToObserverVec;
 };
 
+// cos/sin of i * 2 * PI / n for i in [0, n], shared by every ring
+class RingTable {
+public:
+    RingTable() = default;
+    explicit RingTable(SizeType n);
+
+    SizeType GetSize() const { return Size; }
+    float Cos(SizeType i) const { return Cosines[i]; }
+    float Sin(SizeType i) const { return Sines[i]; }
+
+private:
+    static const float PI;
+
+    SizeType Size = 0;
+    std::vector<float> Cosines;
+    std::vector<float> Sines;
+};
+
+// One object-space ring with its surface normals. Rings are immutable
+// once built, so meshes sampling the same height share them.
+struct ObjectRing {
+    LenghtType Height;
+    std::vector<Vec4> Points;
+    std::vector<Vec4> Normals;
+    // plain coordinates and normals, the last one repeats the first
+    std::vector<float> X;
+    std::vector<float> Y;
+    std::vector<float> NormalX;
+    std::vector<float> NormalY;
+    std::vector<float> NormalZ;
+};
+
+// Object-space rings of the ellipsoid layer with their surface normals.
+// Depends only on the shape and tessellation, so it is reused while the
+// view or the light changes.
+class ObjectMesh {
+public:
+    using RingPointer = std::shared_ptr<const ObjectRing>;
+
+    ObjectMesh() = default;
+    ObjectMesh(LenghtType a,
+               LenghtType b,
+               LenghtType c,
+               const std::vector<LenghtType>& heights,
+               const RingTable& ring);
+    ObjectMesh(SizeType ringSize, std::vector<RingPointer>&& rings)
+        : RingSize{ringSize}, Rings{std::move(rings)} {}
+
+    // Points matching previous, sampled with previousRing, are copied
+    // from it instead of being computed. Returns how many were copied.
+    static SizeType GenerateRing(LenghtType a,
+                                 LenghtType b,
+                                 LenghtType c,
+                                 LenghtType height,
+                                 const RingTable& ring,
+                                 const ObjectRing* previous,
+                                 const RingTable* previousRing,
+                                 ObjectRing& result);
+
+    SizeType GetRingCount() const { return Rings.size(); }
+    SizeType GetRingSize() const { return RingSize; }
+    LenghtType GetHeight(SizeType k) const { return Rings[k]->Height; }
+
+    // i == GetRingSize() wraps around to the first point
+    const Vec4& GetPoint(SizeType k, SizeType i) const {
+        return Rings[k]->Points[i % RingSize];
+    }
+    const Vec4& GetNormal(SizeType k, SizeType i) const {
+        return Rings[k]->Normals[i % RingSize];
+    }
+
+    // ring coordinates as plain arrays of GetRingSize() + 1 values,
+    // the last one repeats the first
+    const float* GetRingX(SizeType k) const { return Rings[k]->X.data(); }
+    const float* GetRingY(SizeType k) const { return Rings[k]->Y.data(); }
+    const float* GetRingNormalX(SizeType k) const {
+        return Rings[k]->NormalX.data();
+    }
+    const float* GetRingNormalY(SizeType k) const {
+        return Rings[k]->NormalY.data();
+    }
+    const float* GetRingNormalZ(SizeType k) const {
+        return Rings[k]->NormalZ.data();
+    }
+
+    // bytes held by the rings
+    SizeType GetMemorySize() const;
+
+private:
+    SizeType RingSize = 0;
+    std::vector<RingPointer> Rings;
+};
+
+// Rings of the last generated mesh, keyed by height. A new tessellation
+// of the same shape takes the rings whose height did not move as they
+// are, and copies every point whose angle is still sampled when only
+// the vertex count changed. Used by one thread at a time.
+class TessellationCache {
+public:
+    struct Stats {
+        // whole rings taken as they are or generated
+        SizeType RingHits = 0;
+        SizeType RingMisses = 0;
+        // points of generated rings copied or computed
+        SizeType PointHits = 0;
+        SizeType PointMisses = 0;
+    };
+
+    ObjectMesh Generate(LenghtType a,
+                        LenghtType b,
+                        LenghtType c,
+                        const std::vector<LenghtType>& heights,
+                        const RingTable& ring);
+
+    const Stats& GetStats() const { return Counters; }
+    void Clear();
+
+private:
+    static std::uint32_t GetKey(LenghtType height);
+
+    LenghtType A = 0;
+    LenghtType B = 0;
+    LenghtType C = 0;
+    RingTable Ring;
+    std::unordered_map<std::uint32_t, ObjectMesh::RingPointer> Rings;
+    Stats Counters;
+};
+
 class Layer {
 public:
     enum class LayerType { SIDE, BOTTOM };
 
     Layer() = default;
-    Layer(LenghtType a,
-          LenghtType b,
-          LenghtType c,
-          LenghtType h,
+    // side layer between rings k and k + 1 or cap layer on ring k
+    Layer(const ObjectMesh& mesh,
+          SizeType k,
+          LayerType type,
+          const Vec3& viewPoint,
+          const Lighting& lighting,
+          ShadingMode shading = ShadingMode::CPU,
+          CullingMode culling = CullingMode::CPU,
+          NormalMode normals = NormalMode::FACE);
+    // Indexed layers reference vertices of a shared pool. As strips a
+    // side band is one strip of 2n + 2 indices and a cap one zigzag
+    // strip over its ring, which leaves the center out.
+    Layer(const VertexVector& pool,
+          SizeType lower,
+          SizeType upper,
           SizeType n,
-          LenghtType deltaH,
-          const Mat4x4& transformMatrix,
           const Vec3& viewPoint,
-          const Lighting& lighting);
-    Layer(LenghtType a,
-          LenghtType b,
-          LenghtType c,
-          LenghtType h,
+          CullingMode culling = CullingMode::CPU,
+          Topology topology = Topology::TRIANGLES);
+    Layer(const VertexVector& pool,
+          SizeType center,
           SizeType n,
-          const Mat4x4& transformMatrix,
           const Vec3& viewPoint,
-          const Lighting& lighting);
+          CullingMode culling = CullingMode::CPU,
+          Topology topology = Topology::TRIANGLES);
 
     const VertexVector& GetVertices() const;
+    const IndexVector& GetIndices() const;
     SizeType GetItemsCount() const;
-    Layer ApplyMatrix(const Mat4x4& matrix) const;
     LayerType GetType() const { return Type; }
+    bool IsIndexed() const { return Indexed; }
+
+    // Generation in two steps for callers that own the storage.
+    // Prepare fills GetScratchSize floats of scratch and returns the
+    // vertex count, Write puts exactly that many vertices at out.
+    static SizeType GetScratchSize(const ObjectMesh& mesh);
+    static SizeType Prepare(const ObjectMesh& mesh,
+                            SizeType k,
+                            LayerType type,
+                            const Vec3& viewPoint,
+                            const Lighting& lighting,
+                            ShadingMode shading,
+                            CullingMode culling,
+                            NormalMode normals,
+                            float* scratch);
+    static void Write(const ObjectMesh& mesh,
+                      SizeType k,
+                      LayerType type,
+                      ShadingMode shading,
+                      NormalMode normals,
+                      float* scratch,
+                      Vertex* out);
 
 private:
-    static const float PI;
+    // SoA arrays per ring: normal, visibility and three intensities
+    // for each of the two triangles of a quad, caps use the first half
+    static constexpr SizeType KERNEL_ARRAY_COUNT = 2 * 7;
 
-    void GenerateVertices(LenghtType a,
-                          LenghtType b,
-                          LenghtType c,
-                          LenghtType h,
-                          SizeType n,
-                          LenghtType deltaH,
-                          const Mat4x4& transformMatrix,
-                          const Vec3& viewPoint,
-                          const Lighting& lighting);
-    void GenerateVertices(LenghtType a,
-                          LenghtType b,
-                          LenghtType c,
-                          LenghtType h,
-                          SizeType n,
-                          const Mat4x4& transformMatrix,
-                          const Vec3& viewPoint,
-                          const Lighting& lighting);
+    static RingKernel::Output MapScratch(float* scratch, SizeType n);
+    template <typename Emit>
+    static void Interleave(const ObjectMesh& mesh,
+                           SizeType k,
+                           LayerType type,
+                           ShadingMode shading,
+                           NormalMode normals,
+                           float* scratch,
+                           Emit&& emit);
 
     static Vec3 ToVec3(const Vec4& vec) { return Vec3(vec[0], vec[1], vec[2]); }
     static Vec3 GetNormal(const Vec4& first,
                           const Vec4& middle,
                           const Vec4& last);
-    static bool CheckNormal(const Vec3& normal, const Vec3& viewPoint);
+    static bool CheckNormal(const Vec3& normal,
+                            const Vec3& viewPoint,
+                            CullingMode culling);
+
+    void AddTriangle(const VertexVector& pool,
+                     IndexType first,
+                     IndexType middle,
+                     IndexType last,
+                     const Vec3& viewPoint);
+    // splits the strip where culling drops triangles
+    void AddStrip(const VertexVector& pool,
+                  const IndexVector& strip,
+                  const Vec3& viewPoint);
 
     VertexVector Vertices;
+    IndexVector Indices;
     LayerType Type;
+    CullingMode Culling = CullingMode::CPU;
+    bool Indexed = false;
 };
 
 using LayerVector = std::vector<Layer>;
 
+// Whole triangle mesh in one block, layer after layer. Generated in
+// place at offsets counted up front, so it reaches the GPU with one copy.
+class PackedMesh {
+public:
+    PackedMesh() = default;
+    // block is left uninitialized for Layer::Write
+    PackedMesh(VertexArena::BlockPointer block,
+               std::vector<SizeType>&& layerOffsets)
+        : Block{std::move(block)}, LayerOffsets{std::move(layerOffsets)} {}
+
+    Vertex* GetVertices() { return Block ? Block->GetData() : nullptr; }
+    const Vertex* GetVertices() const {
+        return Block ? Block->GetData() : nullptr;
+    }
+    SizeType GetVertexCount() const {
+        return LayerOffsets.empty() ? 0 : LayerOffsets.back();
+    }
+    // first vertex of every layer followed by the total
+    const std::vector<SizeType>& GetLayerOffsets() const {
+        return LayerOffsets;
+    }
+    // bytes held, the block may be larger than the mesh
+    SizeType GetMemorySize() const;
+    // copy in a block sized to the mesh that no arena knows of, for
+    // keeping the mesh without holding the arena's block
+    PackedMesh Detach() const;
+
+private:
+    // shared with the arena, which reuses it once the mesh is gone
+    VertexArena::BlockPointer Block;
+    std::vector<SizeType> LayerOffsets;
+};
+
+class IndexedMesh {
+public:
+    IndexedMesh() = default;
+    IndexedMesh(VertexVector&& vertices,
+                LayerVector&& layers,
+                Topology topology = Topology::TRIANGLES)
+        : Vertices{std::move(vertices)},
+          Layers{std::move(layers)},
+          MeshTopology{topology} {}
+
+    const VertexVector& GetVertices() const { return Vertices; }
+    const LayerVector& GetLayers() const { return Layers; }
+    Topology GetTopology() const { return MeshTopology; }
+    SizeType GetIndexCount() const;
+
+private:
+    VertexVector Vertices;
+    LayerVector Layers;
+    Topology MeshTopology = Topology::TRIANGLES;
+};
+
 class Ellipsoid {
 public:
+    // position of a ring as a reduced fraction of the layer height
+    using RingKey = std::pair<SizeType, SizeType>;
+
+    static const Vec4 BASE_COLOR;
+
     Ellipsoid() = default;
     Ellipsoid(LenghtType a,
               LenghtType b,
@@ -124,15 +437,77 @@ public:
               const Vec3& viewPoint);
 
     SizeType GetVertexCount() const;
+    bool HasSameShape(const Ellipsoid& other) const;
+    ShapeKey GetShapeKey() const;
+    // largest ring radius along x and y, half the layer height along z
+    Vec3 GetHalfExtent() const;
+    // side layers span heights from -GetMaxHeight() to GetMaxHeight()
+    static LenghtType GetMaxHeight() { return STOP_HEIGHT; }
+    // Largest radial distance between the slices and the true surface,
+    // the error the slicing adds on top of the ring polygons.
+    LenghtType GetSliceDeviation() const;
+    ObjectMesh GenerateObjectMesh() const;
+    // reuses whatever the last mesh generated through cache still fits
+    ObjectMesh GenerateObjectMesh(TessellationCache& cache) const;
+
+    // Vertices stay in object space, the rotation only orients culling
+    // and lighting. Rendering applies it through the transform matrix.
+    // Triangles are wound counter-clockwise seen from outside.
     LayerVector GenerateVertices(const Mat4x4& rotateMatrix,
                                  const Lighting& lighting) const;
+    LayerVector GenerateVertices(
+        const ObjectMesh& mesh,
+        const Mat4x4& rotateMatrix,
+        const Lighting& lighting,
+        ShadingMode shading = ShadingMode::CPU,
+        CullingMode culling = CullingMode::CPU,
+        NormalMode normals = NormalMode::FACE) const;
+    // Same triangles as GenerateVertices, packed into one block. Storage
+    // comes from arena when given, so steady rebuilds do not allocate.
+    PackedMesh GeneratePackedMesh(
+        const ObjectMesh& mesh,
+        const Mat4x4& rotateMatrix,
+        const Lighting& lighting,
+        ShadingMode shading = ShadingMode::CPU,
+        CullingMode culling = CullingMode::CPU,
+        NormalMode normals = NormalMode::FACE,
+        VertexArena* arena = nullptr) const;
+    IndexedMesh GenerateIndexedMesh(const Mat4x4& rotateMatrix,
+                                    const Lighting& lighting) const;
+    // The whole mesh is one draw either way, strips need primitive
+    // restart with RESTART_INDEX. Side vertices always carry the
+    // analytic normals.
+    IndexedMesh GenerateIndexedMesh(
+        const ObjectMesh& mesh,
+        const Mat4x4& rotateMatrix,
+        const Lighting& lighting,
+        ShadingMode shading = ShadingMode::CPU,
+        CullingMode culling = CullingMode::CPU,
+        Topology topology = Topology::TRIANGLES) const;
 
     void SetVertexCount(SizeType count);
     void SetSurfaceCount(SizeType count);
+    void SetSlicingMode(SlicingMode mode) { Slicing = mode; }
+
+    // Ring k of count + 1. Heights are computed from the key, so a ring
+    // at the same position gets the very same height for every count.
+    static RingKey GetRingKey(SizeType k, SizeType count);
 
 private:
-    static LayerVector ApplyMatrix(const LayerVector& layers,
-                                   const Mat4x4& matrix);
+    static constexpr LenghtType START_HEIGHT = -0.1f;
+    static constexpr LenghtType STOP_HEIGHT = 0.1f;
+    static_assert(START_HEIGHT == -STOP_HEIGHT, "layer is not centered");
+    static constexpr SizeType CHUNKS_PER_THREAD = 4;
+    // resolution of the numeric integral behind adaptive slicing
+    static constexpr SizeType ADAPTIVE_SAMPLES = 256;
+    static constexpr SizeType DEVIATION_SAMPLES = 16;
+
+    // SurfaceCount + 1 rings from START_HEIGHT to STOP_HEIGHT
+    std::vector<LenghtType> GenerateHeights() const;
+    std::vector<LenghtType> GenerateAdaptiveHeights() const;
+    // ring radius at height relative to its value at zero height
+    LenghtType GetProfile(LenghtType height) const;
+    Vec3 GetObjectViewPoint(const Mat4x4& rotateMatrix) const;
 
     LenghtType A;
     LenghtType B;
@@ -140,6 +515,8 @@ private:
     SizeType VertexCount;
     SizeType SurfaceCount;
     Vec3 ViewPoint;
+    RingTable Ring;
+    SlicingMode Slicing = SlicingMode::UNIFORM;
 };
 
 #endif  // CG_LAB_ELLIPSOID_HPP_
@@ -0,0 +1,56 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_LEVELOFDETAIL_HPP_
+#define CG_LAB_LEVELOFDETAIL_HPP_
+
+#include <Ellipsoid.hpp>
+
+#include <vector>
+
+// FIXED takes the tessellation from the sliders, AUTO from the size
+// of the ellipsoid on screen
+enum class LodMode { FIXED, AUTO };
+
+// Ladder of tessellations for one shape. Level i is meant for up to
+// MIN_PIXELS_PER_UNIT * 2^i pixels per object unit and keeps triangle
+// edges near the target length there. Levels are fixed, so zooming
+// back and forth keeps landing on shapes the mesh caches already hold.
+class LevelOfDetail {
+public:
+    struct Level {
+        SizeType VertexCount;
+        SizeType SurfaceCount;
+    };
+
+    static constexpr float DEFAULT_TARGET_EDGE = 8.0f;
+
+    LevelOfDetail() = default;
+    // halfExtent is the largest ring radius along x and y and half the
+    // height of the layer, targetEdge is in pixels
+    explicit LevelOfDetail(const Vec3& halfExtent,
+                           float targetEdge = DEFAULT_TARGET_EDGE);
+
+    // stays on current until the scale is clearly below its range
+    SizeType Select(float pixelsPerUnit, SizeType current) const;
+
+    const Level& GetLevel(SizeType index) const { return Levels[index]; }
+    SizeType GetLevelCount() const { return Levels.size(); }
+
+private:
+    static constexpr float MIN_PIXELS_PER_UNIT = 16.0f;
+    static constexpr float HYSTERESIS = 0.75f;
+    static constexpr SizeType MIN_VERTEX_COUNT = 8;
+    static constexpr SizeType MIN_SURFACE_COUNT = 2;
+    static constexpr SizeType MAX_VERTEX_COUNT = 512;
+    static constexpr SizeType MAX_SURFACE_COUNT = 256;
+    static constexpr SizeType MAX_LEVEL_COUNT = 16;
+
+    static float GetLevelScale(SizeType index);
+
+    std::vector<Level> Levels;
+};
+
+#endif  // CG_LAB_LEVELOFDETAIL_HPP_
@@ -0,0 +1,124 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_LRUCACHE_HPP_
+#define CG_LAB_LRUCACHE_HPP_
+
+#include <cstddef>
+#include <iterator>
+#include <list>
+#include <map>
+#include <utility>
+
+// Least recently used cache with a memory budget. Every entry is charged
+// the size given on insert, the least recently used ones are dropped
+// while the total is over budget. Not thread safe.
+template <typename Key, typename Value>
+class LruCache {
+public:
+    using SizeType = std::size_t;
+
+    struct Stats {
+        SizeType Hits = 0;
+        SizeType Misses = 0;
+        SizeType Evictions = 0;
+        SizeType Entries = 0;
+        SizeType Bytes = 0;
+        SizeType Budget = 0;
+    };
+
+    explicit LruCache(SizeType budget) { Counters.Budget = budget; }
+
+    // marks the entry as the most recently used one
+    const Value* Find(const Key& key);
+    // neither counted nor marked
+    bool Contains(const Key& key) const { return Index.count(key) != 0; }
+    // entries larger than the whole budget are not kept
+    void Insert(const Key& key, Value value, SizeType bytes);
+    void SetBudget(SizeType budget);
+    void Clear();
+
+    const Stats& GetStats() const { return Counters; }
+
+private:
+    struct Entry {
+        Key EntryKey;
+        Value EntryValue;
+        SizeType Bytes;
+    };
+    using EntryList = std::list<Entry>;
+
+    void Erase(typename EntryList::iterator entry);
+    void Trim();
+
+    // most recently used first
+    EntryList Entries;
+    std::map<Key, typename EntryList::iterator> Index;
+    Stats Counters;
+};
+
+template <typename Key, typename Value>
+const Value* LruCache<Key, Value>::Find(const Key& key) {
+    const auto found = Index.find(key);
+    if (found == Index.end()) {
+        Counters.Misses++;
+        return nullptr;
+    }
+
+    Counters.Hits++;
+    Entries.splice(Entries.begin(), Entries, found->second);
+    return &found->second->EntryValue;
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::Insert(const Key& key,
+                                  Value value,
+                                  SizeType bytes) {
+    const auto found = Index.find(key);
+    if (found != Index.end()) {
+        Erase(found->second);
+    }
+    if (bytes > Counters.Budget) {
+        return;
+    }
+
+    Entries.push_front({key, std::move(value), bytes});
+    Index.emplace(key, Entries.begin());
+    Counters.Entries++;
+    Counters.Bytes += bytes;
+    Trim();
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::SetBudget(SizeType budget) {
+    Counters.Budget = budget;
+    Trim();
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::Clear() {
+    Entries.clear();
+    Index.clear();
+    Counters.Entries = 0;
+    Counters.Bytes = 0;
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::Erase(typename EntryList::iterator entry) {
+    Counters.Entries--;
+    Counters.Bytes -= entry->Bytes;
+    Index.erase(entry->EntryKey);
+    Entries.erase(entry);
+}
+
+template <typename Key, typename Value>
+void LruCache<Key, Value>::Trim() {
+    while (Counters.Bytes > Counters.Budget) {
+        Erase(std::prev(Entries.end()));
+        Counters.Evictions++;
+    }
+}
+
+#endif  // CG_LAB_LRUCACHE_HPP_
@@ -0,0 +1,126 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_MESHBUFFER_HPP_
+#define CG_LAB_MESHBUFFER_HPP_
+
+#include <CompactVertex.hpp>
+#include <Ellipsoid.hpp>
+#include <Scene.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
+
+class QOpenGLFunctions_3_3_Core;
+class QOpenGLShaderProgram;
+
+enum class VertexFormat { FULL, COMPACT };
+
+// Long-lived VBO/VAO pair for ellipsoid layers. Storage grows
+// geometrically and is refilled only when the mesh generation changes.
+// Layer ranges are recorded into a draw list on upload and submitted
+// with a single draw call. Indexed meshes use an element buffer with
+// 16 bit indices whenever the vertex pool is small enough, strips are
+// drawn with primitive restart. Packed meshes are copied into the
+// mapped buffer in one go. The compact format quantizes color and
+// normal while copying, see CompactVertex.
+// Instances go to a buffer of their own, read once per instance by
+// DrawInstanced through a second VAO, so a whole scene shares one copy
+// of the mesh and plain draws never see the instance attributes.
+class MeshBuffer {
+public:
+    using GenerationType = std::uint64_t;
+
+    // every shader program binds its attributes to these locations,
+    // so the two VAOs serve all of them
+    static constexpr int POSITION_LOCATION = 0;
+    static constexpr int COLOR_LOCATION = 1;
+    static constexpr int NORMAL_LOCATION = 2;
+    static constexpr int INSTANCE_POSITION_LOCATION = 3;
+    static constexpr int INSTANCE_AXES_LOCATION = 4;
+    static constexpr int INSTANCE_ROTATION_LOCATION = 5;
+    static constexpr int INSTANCE_COLOR_LOCATION = 6;
+
+    MeshBuffer();
+
+    void Create(QOpenGLShaderProgram* program);
+    void Destroy();
+    // takes effect with the next upload
+    void SetFormat(VertexFormat format);
+
+    void Upload(const LayerVector& layers, GenerationType generation);
+    void Upload(const IndexedMesh& mesh, GenerationType generation);
+    void Upload(const PackedMesh& mesh, GenerationType generation);
+    void UploadInstances(const std::vector<Instance>& instances,
+                         GenerationType generation);
+    void Bind();
+    void Draw();
+    // the mesh once per uploaded instance, one call per draw range
+    void DrawInstanced();
+    void Release();
+
+    VertexFormat GetFormat() const { return Format; }
+    SizeType GetVertexSize() const;
+    SizeType GetCapacity() const { return Capacity; }
+    SizeType GetSize() const { return Size; }
+    SizeType GetIndexCount() const { return IndexCount; }
+    SizeType GetInstanceCount() const { return InstanceCount; }
+    // written into the buffers since creation, skipped uploads are free
+    SizeType GetUploadedBytes() const { return UploadedBytes; }
+    SizeType GetDrawCallCount() const { return DrawCallCount; }
+
+    static SizeType GetVertexCount(const LayerVector& layers);
+
+private:
+    static constexpr SizeType GROWTH_FACTOR = 2;
+
+    static SizeType Grow(SizeType capacity, SizeType size);
+
+    void SetAttributes();
+    void SetVertexAttributes();
+    void SetInstanceAttributes();
+    void AllocateVertices(SizeType count);
+    void WriteVertices(SizeType first, const Vertex* vertices, SizeType count);
+    void WriteIndices(const LayerVector& layers,
+                      SizeType poolSize,
+                      bool isStrip);
+    void BuildDrawList(const LayerVector& layers);
+
+    QOpenGLFunctions_3_3_Core* Functions;
+    QOpenGLShaderProgram* Program;
+    QOpenGLBuffer Buffer;
+    QOpenGLBuffer IndexBuffer;
+    QOpenGLBuffer InstanceBuffer;
+    QOpenGLVertexArrayObject VertexArray;
+    // the mesh and the per-instance attributes, for DrawInstanced only
+    QOpenGLVertexArrayObject InstanceVertexArray;
+    std::vector<GLint> DrawFirsts;
+    std::vector<GLsizei> DrawCounts;
+    std::vector<const void*> DrawOffsets;
+    std::vector<std::uint16_t> ShortIndices;
+    std::vector<CompactVertex> CompactVertices;
+    VertexFormat Format;
+    SizeType Capacity;
+    SizeType Size;
+    SizeType IndexCapacity;
+    SizeType IndexCount;
+    SizeType IndexSize;
+    GLenum IndexFormat;
+    SizeType InstanceCapacity;
+    SizeType InstanceCount;
+    GenerationType InstanceGeneration;
+    SizeType UploadedBytes;
+    SizeType DrawCallCount;
+    GenerationType Generation;
+    bool IsUploaded;
+    bool IsIndexed;
+    bool IsStrip;
+    bool AreInstancesUploaded;
+};
+
+#endif  // CG_LAB_MESHBUFFER_HPP_
@@ -0,0 +1,139 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_MESHBUILDER_HPP_
+#define CG_LAB_MESHBUILDER_HPP_
+
+#include <Ellipsoid.hpp>
+#include <LruCache.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+
+// PACKED has the same triangles as TRIANGLES in one contiguous block,
+// STRIPS is INDEXED with triangle strips
+enum class MeshMode { TRIANGLES, INDEXED, PACKED, STRIPS };
+
+struct MeshRequest {
+    Ellipsoid Object;
+    Mat4x4 RotateMatrix;
+    Lighting Light;
+    MeshMode Mode;
+    ShadingMode Shading;
+    CullingMode Culling;
+    // TRIANGLES and PACKED only, indexed meshes share analytic normals
+    NormalMode Normals = NormalMode::FACE;
+
+    // false if one mesh serves every rotation and light
+    bool DependsOnView() const {
+        return Culling == CullingMode::CPU || Shading == ShadingMode::CPU;
+    }
+};
+
+// only the member matching the mode is filled
+struct MeshData {
+    LayerVector Layers;
+    IndexedMesh Indexed;
+    PackedMesh Packed;
+
+    SizeType GetMemorySize() const;
+};
+
+struct MeshResult {
+    std::uint64_t Id;
+    MeshMode Mode;
+    ShadingMode Shading;
+    CullingMode Culling;
+    // shared with the cache, never changed once built
+    std::shared_ptr<const MeshData> Data;
+};
+
+// Rebuilds meshes on a background thread. Only the latest posted request
+// matters: a pending request is replaced by a newer one and a finished
+// build is dropped if something newer was posted while it was running.
+// The object-space geometry is kept between builds while the shape and
+// tessellation stay the same, and a new tessellation reuses the rings
+// that are still valid. Recently used shapes are cached: their
+// object-space geometry always, and the finished mesh too when it does
+// not depend on the view. Prefetched requests only fill the caches and
+// run while nothing else is pending.
+class MeshBuilder {
+public:
+    using ResultPointer = std::shared_ptr<MeshResult>;
+    using DataPointer = std::shared_ptr<const MeshData>;
+    using Callback = std::function<void(ResultPointer)>;
+    using GeometryCache = LruCache<ShapeKey, ObjectMesh>;
+    using ResultKey = std::tuple<ShapeKey, MeshMode, NormalMode>;
+    using ResultCache = LruCache<ResultKey, DataPointer>;
+
+    // for each of the two caches
+    static constexpr SizeType DEFAULT_CACHE_BUDGET = 128 * 1024 * 1024;
+
+    explicit MeshBuilder(Callback onReady);
+    ~MeshBuilder();
+
+    MeshBuilder(const MeshBuilder&) = delete;
+    MeshBuilder& operator=(const MeshBuilder&) = delete;
+
+    std::uint64_t Post(MeshRequest request);
+    // keeps the last MAX_PREFETCH_COUNT requests
+    void Prefetch(MeshRequest request);
+    bool IsLatest(std::uint64_t id) const { return id == LatestId; }
+    SizeType GetSupersededCount() const { return SupersededCount; }
+    // storage reuse of the packed meshes
+    VertexArena::Stats GetArenaStats() const { return Arena.GetStats(); }
+    TessellationCache::Stats GetTessellationStats() const;
+    GeometryCache::Stats GetGeometryCacheStats() const;
+    ResultCache::Stats GetResultCacheStats() const;
+    // applied before the next build
+    void SetCacheBudget(SizeType bytes) { CacheBudget = bytes; }
+
+private:
+    static constexpr SizeType MAX_PREFETCH_COUNT = 2;
+
+    ResultPointer Build(const MeshRequest& request);
+    void Warm(const MeshRequest& request);
+    DataPointer Generate(const MeshRequest& request,
+                         const ObjectMesh& geometry);
+    static DataPointer ToCached(const DataPointer& data);
+    void UpdateGeometry(const Ellipsoid& object);
+    void UpdateStats();
+    void Run();
+
+    Callback OnReady;
+    mutable std::mutex Mutex;
+    std::condition_variable Condition;
+    std::optional<MeshRequest> Pending;
+    std::deque<MeshRequest> Prefetches;
+    std::atomic<std::uint64_t> LatestId;
+    std::atomic<SizeType> SupersededCount;
+    std::atomic<SizeType> CacheBudget;
+    // copies of the build thread's counters, guarded by Mutex
+    TessellationCache::Stats TessellationStats;
+    GeometryCache::Stats GeometryStats;
+    ResultCache::Stats ResultStats;
+    bool IsStopping;
+    // touched by the build thread only
+    Ellipsoid GeometryShape;
+    ObjectMesh Geometry;
+    TessellationCache Tessellation;
+    // for prefetched shapes, which never become the current geometry
+    TessellationCache PrefetchTessellation;
+    GeometryCache Geometries;
+    ResultCache Results;
+    bool HasGeometry;
+    VertexArena Arena;
+    std::thread Worker;
+};
+
+#endif  // CG_LAB_MESHBUILDER_HPP_
@@ -6,8 +6,15 @@
 #ifndef CG_LAB_MYCONTROLWIDGET_HPP_
 #define CG_LAB_MYCONTROLWIDGET_HPP_
 
+#include <LevelOfDetail.hpp>
+#include <MeshBuffer.hpp>
+#include <MeshBuilder.hpp>
+#include <Scene.hpp>
+
 #include <QWidget>
 
+class QComboBox;
+
 namespace Ui {
 class MyControlWidget;
 }
@@ -33,11 +40,25 @@ signals:
     void AmbientChangedSignal(float ambientCoeff);
     void SpecularChangedSignal(float specularCoeff);
     void DiffuseChangedSignal(float diffuseCoeff);
+    void ShineChangedSignal(int shineCoeff);
+
+    void SceneModeChangedSignal(SceneMode mode);
+    void CullingModeChangedSignal(CullingMode mode);
+    void ShadingModeChangedSignal(ShadingMode mode);
+    void MeshModeChangedSignal(MeshMode mode);
+    void LodModeChangedSignal(LodMode mode);
+    void SlicingModeChangedSignal(SlicingMode mode);
+    void VertexFormatChangedSignal(VertexFormat format);
+    void NormalModeChangedSignal(NormalMode mode);
 
 private:
     static const float PI;
     static const float TETA_MAX;
 
+    template <typename Mode>
+    void ConnectComboBox(QComboBox* comboBox,
+                         void (MyControlWidget::*signal)(Mode));
+
     Ui::MyControlWidget* WidgetUi;
 };
 
@@ -9,6 +9,7 @@
 #include <QMainWindow>
 
 #include <array>
+#include <cstddef>
 
 class MyOpenGLWidget;
 
@@ -19,6 +20,9 @@ public:
     explicit MyMainWindow(QWidget* parent = nullptr);
     ~MyMainWindow() = default;
 
+    // of each mesh builder cache, 0 disables caching
+    void SetCacheBudget(std::size_t bytes);
+
     static constexpr auto VARIANT_DESCRIPTION =
         "Computer grapics lab 3\n"
         "Variant 20: ellipsoid layer\n"
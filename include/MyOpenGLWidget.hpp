@@ -7,14 +7,16 @@
 #define CG_LAB_MYOPENGLWIDGET_HPP_
 
 #include <Ellipsoid.hpp>
+#include <LevelOfDetail.hpp>
+#include <MeshBuffer.hpp>
+#include <MeshBuilder.hpp>
+#include <Scene.hpp>
 
 #include <array>
 
 #include <QOpenGLFunctions>
 #include <QOpenGLWidget>
 
-class QOpenGLBuffer;
-class QOpenGLVertexArrayObject;
 class QOpenGLShaderProgram;
 
 class MyOpenGLWidget : public QOpenGLWidget, protected QOpenGLFunctions {
@@ -30,6 +32,29 @@ public:
                             SizeType vertexCount,
                             SizeType surfaceCount,
                             QWidget* parent = nullptr);
+    ~MyOpenGLWidget();
+
+    SizeType GetDrawCallCount() const;
+    // time spent in the last paintGL call
+    qint64 GetFrameTime() const { return FrameTime; }
+    VertexArena::Stats GetArenaStats() const;
+    TessellationCache::Stats GetTessellationStats() const;
+    MeshBuilder::GeometryCache::Stats GetGeometryCacheStats() const;
+    MeshBuilder::ResultCache::Stats GetResultCacheStats() const;
+    // of the last frame in the INSTANCED mode
+    Scene::CullStats GetCullStats() const { return SceneCulling; }
+    void SetCacheBudget(SizeType bytes);
+    void SetMeshMode(MeshMode mode);
+    void SetShadingMode(ShadingMode mode);
+    void SetCullingMode(CullingMode mode);
+    void SetNormalMode(NormalMode mode);
+    void SetLodMode(LodMode mode);
+    void SetSlicingMode(SlicingMode mode);
+    void SetVertexFormat(VertexFormat format);
+    void SetSceneMode(SceneMode mode);
+    // shown in the INSTANCED mode
+    void SetScene(Scene scene);
+    SizeType GetLodLevel() const { return LodLevel; }
 
 public slots:
     void ScaleUpSlot();
@@ -42,6 +67,7 @@ public slots:
     void AmbientChangedSlot(float ambientCoeff);
     void SpecularChangedSlot(float specularCoeff);
     void DiffuseChangedSlot(float diffuseCoeff);
+    void ShineChangedSlot(int shineCoeff);
 
     void VertexCountChangedSlot(int count);
     void SurfaceCountChangedSlot(int count);
@@ -60,32 +86,70 @@ private:
     static constexpr auto WIDGET_DEFAULT_SIZE = QSize(350, 350);
     static constexpr auto IMAGE_DEFAULT_SIZE = QSize(300, 300);
     static const Vec3 VIEW_POINT;
+    static const Vec3 LIGHT_POSITION;
+    static const Vec3 TO_OBSERVER;
 
     static constexpr auto VERTEX_SHADER = ":/shaders/vertexShader.glsl";
     static constexpr auto FRAGMENT_SHADER = ":/shaders/fragmentShader.glsl";
+    static constexpr auto LIGHTING_VERTEX_SHADER =
+        ":/shaders/lightingVertexShader.glsl";
+    static constexpr auto LIGHTING_FRAGMENT_SHADER =
+        ":/shaders/lightingFragmentShader.glsl";
+    static constexpr auto INSTANCE_VERTEX_SHADER =
+        ":/shaders/instanceVertexShader.glsl";
     static constexpr auto POSITION = "position";
     static constexpr auto COLOR = "color";
+    static constexpr auto NORMAL = "normal";
+    static constexpr auto INSTANCE_POSITION = "instancePosition";
+    static constexpr auto INSTANCE_AXES = "instanceAxes";
+    static constexpr auto INSTANCE_ROTATION = "instanceRotation";
+    static constexpr auto INSTANCE_COLOR = "instanceColor";
     static constexpr auto TRANSFORM_MATRIX = "transformMatrix";
+    static constexpr auto ROTATE_MATRIX = "rotateMatrix";
+    static constexpr auto MESH_SCALE = "meshScale";
+    static constexpr auto AMBIENT_COEFF = "ambientCoeff";
+    static constexpr auto SPECULAR_COEFF = "specularCoeff";
+    static constexpr auto DIFFUSE_COEFF = "diffuseCoeff";
+    static constexpr auto SHINE_COEFF = "shineCoeff";
+    static constexpr auto LIGHT = "light";
+    static constexpr auto TO_OBSERVER_VEC = "toObserver";
 
     static constexpr auto SCALE_FACTOR_PER_ONCE = 1.15f;
-
-    static SizeType GetVertexCount(const LayerVector& layers);
+    // generated when the INSTANCED mode is first selected, unless
+    // another scene was set before
+    static constexpr SizeType DEFAULT_INSTANCE_COUNT = 1000;
+    static constexpr auto SCENE_RADIUS = 0.5f;
 
     void UpdateOnChange(int width, int height);
+    void UpdateTransform(int width, int height);
+    void RequestMesh();
+    MeshRequest CreateRequest(const Ellipsoid& object) const;
+    bool UpdateLevelOfDetail();
+    float GetPixelsPerUnit() const;
+    bool DependsOnView() const;
     void OnWidgetUpdate();
+    void ApplyMesh(MeshBuilder::ResultPointer result);
 
     Mat4x4 GenerateScaleMatrix(int width, int height) const;
+    Mat4x4 GenerateRotateMatrix() const;
     Mat4x4 GenerateRotateMatrix(RotateType rotateType) const;
 
-    void SetUniformMatrix(const Mat4x4& transformMatrix);
+    QOpenGLShaderProgram* CreateShaderProgram(const char* vertexShader,
+                                              const char* fragmentShader);
+    void SetLightingUniforms(QOpenGLShaderProgram* program);
+    static void SetUniformMatrix(QOpenGLShaderProgram* program,
+                                 const char* name,
+                                 const Mat4x4& matrix);
 
     static Mat4x4 GenerateRotateMatrixByAngle(RotateType rotateType,
                                               FloatType angle);
     static Mat4x4 GenerateProjectionMatrix();
 
     QOpenGLShaderProgram* ShaderProgram;
-    QOpenGLBuffer* Buffer;
-    QOpenGLVertexArrayObject* VertexArray;
+    QOpenGLShaderProgram* LightingProgram;
+    QOpenGLShaderProgram* InstanceProgram;
+    MeshBuffer* Mesh;
+    MeshBuilder* Builder;
     Ellipsoid EllipsoidLayer;
     FloatType ScaleFactor;
     FloatType AngleOX;
@@ -94,12 +158,36 @@ private:
     FloatType AmbientCoeff;
     FloatType SpecularCoeff;
     FloatType DiffuseCoeff;
+    unsigned ShineCoeff;
     FloatType A;
     FloatType B;
     FloatType C;
     SizeType VertexCount;
     SizeType SurfaceCount;
-    LayerVector Layers;
+    MeshBuilder::DataPointer BuiltData;
+    MeshMode Mode;
+    MeshMode BuiltMode;
+    ShadingMode Shading;
+    ShadingMode BuiltShading;
+    CullingMode Culling;
+    CullingMode BuiltCulling;
+    NormalMode Normals;
+    VertexFormat Format;
+    SceneMode SceneType;
+    SceneMode BuiltSceneType;
+    Scene Instances;
+    std::vector<Instance> VisibleInstances;
+    Scene::CullStats SceneCulling;
+    // changes with the scene and the view
+    MeshBuffer::GenerationType SceneGeneration;
+    MeshBuffer::GenerationType CulledGeneration;
+    LodMode Lod;
+    LevelOfDetail Levels;
+    SizeType LodLevel;
+    MeshBuffer::GenerationType MeshGeneration;
+    Mat4x4 RotateMatrix;
+    Mat4x4 TransformMatrix;
+    qint64 FrameTime;
 };
 
 #endif  // CG_LAB_MYOPENGLWIDGET_HPP_
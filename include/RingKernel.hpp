@@ -0,0 +1,82 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_RINGKERNEL_HPP_
+#define CG_LAB_RINGKERNEL_HPP_
+
+#include <cstddef>
+
+// Vectorized kernel for the side layers. Works on structure-of-arrays
+// rings: every quad between two neighbouring rings gives two triangles,
+// the kernel computes their face normals, visibility and per-vertex
+// lighting. Interleaving into Vertex is left to the caller.
+//
+// Keep this header free of Eigen and the standard containers: it is
+// also compiled with -mavx and inline code from there must not leak
+// into the rest of the program.
+class RingKernel {
+public:
+    using SizeType = std::size_t;
+
+    enum class Level { SCALAR, SSE, AVX };
+
+    struct Input {
+        // Count + 1 points per ring, the last one repeats the first
+        const float* LowerX;
+        const float* LowerY;
+        float LowerZ;
+        const float* UpperX;
+        const float* UpperY;
+        float UpperZ;
+        SizeType Count;
+        // xyz arrays of vertex normals laid out like the points, or all
+        // null to light and cull by the face normals
+        const float* LowerNormal[3];
+        const float* UpperNormal[3];
+
+        float ViewPoint[3];
+        float Light[3];
+        float ToObserver[3];
+        float AmbientCoeff;
+        float SpecularCoeff;
+        float DiffuseCoeff;
+        unsigned ShineCoeff;
+
+        // Cull drops faces turned away from ViewPoint,
+        // Shade fills Intensity
+        bool Cull;
+        bool Shade;
+    };
+
+    // Count entries per array. Triangle 0 is (lower i, lower i + 1,
+    // upper i), triangle 1 is (upper i, lower i + 1, upper i + 1).
+    // Face normals are not written when vertex normals are given.
+    struct Output {
+        float* NormalX[2];
+        float* NormalY[2];
+        float* NormalZ[2];
+        // 1 if the triangle is kept, 0 otherwise
+        float* Visible[2];
+        float* Intensity[2][3];
+    };
+
+    static void Run(const Input& input, const Output& output);
+
+    // best level the CPU supports, unless lowered by SetLevel
+    static Level GetLevel();
+    static Level GetSupportedLevel();
+    static void SetLevel(Level level);
+    static const char* GetLevelName(Level level);
+
+private:
+    static void RunScalar(const Input& input, const Output& output);
+    static void RunSse(const Input& input, const Output& output);
+    static void RunAvx(const Input& input, const Output& output);
+    static bool HasAvx();
+
+    static Level CurrentLevel;
+};
+
+#endif  // CG_LAB_RINGKERNEL_HPP_
@@ -0,0 +1,297 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_RINGKERNELIMPL_HPP_
+#define CG_LAB_RINGKERNELIMPL_HPP_
+
+#include <RingKernel.hpp>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Included by the RingKernel sources only. Everything here has internal
+// linkage, so the copy built with -mavx never replaces the others.
+namespace {
+
+struct ScalarBatch {
+    static constexpr RingKernel::SizeType SIZE = 1;
+    using Mask = bool;
+
+    float Value;
+
+    static ScalarBatch Load(const float* data) { return {*data}; }
+    static ScalarBatch Set(float value) { return {value}; }
+    void Store(float* data) const { *data = Value; }
+
+    friend ScalarBatch operator+(ScalarBatch a, ScalarBatch b) {
+        return {a.Value + b.Value};
+    }
+    friend ScalarBatch operator-(ScalarBatch a, ScalarBatch b) {
+        return {a.Value - b.Value};
+    }
+    friend ScalarBatch operator*(ScalarBatch a, ScalarBatch b) {
+        return {a.Value * b.Value};
+    }
+    friend ScalarBatch operator/(ScalarBatch a, ScalarBatch b) {
+        return {a.Value / b.Value};
+    }
+
+    // builtin rather than std::sqrt, which is an inline function
+    static ScalarBatch Sqrt(ScalarBatch a) {
+        return {__builtin_sqrtf(a.Value)};
+    }
+    static ScalarBatch Max(ScalarBatch a, ScalarBatch b) {
+        return {a.Value > b.Value ? a.Value : b.Value};
+    }
+    static Mask Greater(ScalarBatch a, ScalarBatch b) {
+        return a.Value > b.Value;
+    }
+    static ScalarBatch Select(Mask mask, ScalarBatch a, ScalarBatch b) {
+        return mask ? a : b;
+    }
+    static ScalarBatch ToFloat(Mask mask) { return {mask ? 1.0f : 0.0f}; }
+};
+
+#ifdef __SSE2__
+struct SseBatch {
+    static constexpr RingKernel::SizeType SIZE = 4;
+    using Mask = __m128;
+
+    __m128 Value;
+
+    static SseBatch Load(const float* data) { return {_mm_loadu_ps(data)}; }
+    static SseBatch Set(float value) { return {_mm_set1_ps(value)}; }
+    void Store(float* data) const { _mm_storeu_ps(data, Value); }
+
+    friend SseBatch operator+(SseBatch a, SseBatch b) {
+        return {_mm_add_ps(a.Value, b.Value)};
+    }
+    friend SseBatch operator-(SseBatch a, SseBatch b) {
+        return {_mm_sub_ps(a.Value, b.Value)};
+    }
+    friend SseBatch operator*(SseBatch a, SseBatch b) {
+        return {_mm_mul_ps(a.Value, b.Value)};
+    }
+    friend SseBatch operator/(SseBatch a, SseBatch b) {
+        return {_mm_div_ps(a.Value, b.Value)};
+    }
+
+    static SseBatch Sqrt(SseBatch a) { return {_mm_sqrt_ps(a.Value)}; }
+    static SseBatch Max(SseBatch a, SseBatch b) {
+        return {_mm_max_ps(a.Value, b.Value)};
+    }
+    static Mask Greater(SseBatch a, SseBatch b) {
+        return _mm_cmpgt_ps(a.Value, b.Value);
+    }
+    static SseBatch Select(Mask mask, SseBatch a, SseBatch b) {
+        return {_mm_or_ps(_mm_and_ps(mask, a.Value),
+                          _mm_andnot_ps(mask, b.Value))};
+    }
+    static SseBatch ToFloat(Mask mask) {
+        return {_mm_and_ps(mask, _mm_set1_ps(1.0f))};
+    }
+};
+#endif
+
+#ifdef __AVX__
+struct AvxBatch {
+    static constexpr RingKernel::SizeType SIZE = 8;
+    using Mask = __m256;
+
+    __m256 Value;
+
+    static AvxBatch Load(const float* data) {
+        return {_mm256_loadu_ps(data)};
+    }
+    static AvxBatch Set(float value) { return {_mm256_set1_ps(value)}; }
+    void Store(float* data) const { _mm256_storeu_ps(data, Value); }
+
+    friend AvxBatch operator+(AvxBatch a, AvxBatch b) {
+        return {_mm256_add_ps(a.Value, b.Value)};
+    }
+    friend AvxBatch operator-(AvxBatch a, AvxBatch b) {
+        return {_mm256_sub_ps(a.Value, b.Value)};
+    }
+    friend AvxBatch operator*(AvxBatch a, AvxBatch b) {
+        return {_mm256_mul_ps(a.Value, b.Value)};
+    }
+    friend AvxBatch operator/(AvxBatch a, AvxBatch b) {
+        return {_mm256_div_ps(a.Value, b.Value)};
+    }
+
+    static AvxBatch Sqrt(AvxBatch a) { return {_mm256_sqrt_ps(a.Value)}; }
+    static AvxBatch Max(AvxBatch a, AvxBatch b) {
+        return {_mm256_max_ps(a.Value, b.Value)};
+    }
+    static Mask Greater(AvxBatch a, AvxBatch b) {
+        return _mm256_cmp_ps(a.Value, b.Value, _CMP_GT_OQ);
+    }
+    static AvxBatch Select(Mask mask, AvxBatch a, AvxBatch b) {
+        return {_mm256_blendv_ps(b.Value, a.Value, mask)};
+    }
+    static AvxBatch ToFloat(Mask mask) {
+        return {_mm256_and_ps(mask, _mm256_set1_ps(1.0f))};
+    }
+};
+#endif
+
+template <typename Batch>
+struct Vec3Batch {
+    Batch X;
+    Batch Y;
+    Batch Z;
+
+    friend Vec3Batch operator+(const Vec3Batch& a, const Vec3Batch& b) {
+        return {a.X + b.X, a.Y + b.Y, a.Z + b.Z};
+    }
+    friend Vec3Batch operator-(const Vec3Batch& a, const Vec3Batch& b) {
+        return {a.X - b.X, a.Y - b.Y, a.Z - b.Z};
+    }
+    friend Vec3Batch operator*(Batch a, const Vec3Batch& b) {
+        return {a * b.X, a * b.Y, a * b.Z};
+    }
+
+    static Vec3Batch Set(const float* vec) {
+        return {Batch::Set(vec[0]), Batch::Set(vec[1]), Batch::Set(vec[2])};
+    }
+    static Batch Dot(const Vec3Batch& a, const Vec3Batch& b) {
+        return a.X * b.X + a.Y * b.Y + a.Z * b.Z;
+    }
+    static Vec3Batch Cross(const Vec3Batch& a, const Vec3Batch& b) {
+        return {a.Y * b.Z - a.Z * b.Y, a.Z * b.X - a.X * b.Z,
+                a.X * b.Y - a.Y * b.X};
+    }
+};
+
+// unit face normal of (first, middle, last), turned away from the origin
+template <typename Batch>
+Vec3Batch<Batch> FaceNormal(const Vec3Batch<Batch>& first,
+                            const Vec3Batch<Batch>& middle,
+                            const Vec3Batch<Batch>& last) {
+    using Vec = Vec3Batch<Batch>;
+    const auto zero = Batch::Set(0);
+
+    Vec normal = Vec::Cross(middle - first, last - first);
+    const Batch squaredNorm = Vec::Dot(normal, normal);
+    // degenerate faces keep a zero normal
+    const Batch scale =
+        Batch::Select(Batch::Greater(squaredNorm, zero),
+                      Batch::Set(1) / Batch::Sqrt(squaredNorm), zero);
+    const Batch sign = Batch::Select(
+        Batch::Greater(zero, Vec::Dot(middle, normal)), Batch::Set(-1),
+        Batch::Set(1));
+    return (scale * sign) * normal;
+}
+
+template <typename Batch>
+Batch Intensity(const RingKernel::Input& input,
+                const Vec3Batch<Batch>& point,
+                const Vec3Batch<Batch>& normal) {
+    using Vec = Vec3Batch<Batch>;
+
+    const Vec toLight = Vec::Set(input.Light) - point;
+    const Batch dot = Vec::Dot(toLight, normal);
+    const Batch diffuse =
+        Batch::Set(input.DiffuseCoeff) * Batch::Max(dot, Batch::Set(0));
+    const Vec reflected = (Batch::Set(2) * dot) * normal - toLight;
+
+    // integer power by squaring, the same as pow for whole exponents,
+    // light reflected away from the observer adds no highlight
+    Batch base = Batch::Max(Vec::Dot(reflected, Vec::Set(input.ToObserver)),
+                            Batch::Set(0));
+    Batch shine = Batch::Set(1);
+    for (auto exponent = input.ShineCoeff; exponent != 0; exponent >>= 1) {
+        if (exponent & 1) {
+            shine = shine * base;
+        }
+        base = base * base;
+    }
+
+    return Batch::Set(input.AmbientCoeff) + diffuse +
+           Batch::Set(input.SpecularCoeff) * shine;
+}
+
+template <typename Batch>
+void RunBatch(const RingKernel::Input& input,
+              const RingKernel::Output& output,
+              RingKernel::SizeType i) {
+    using Vec = Vec3Batch<Batch>;
+
+    const Batch lowerZ = Batch::Set(input.LowerZ);
+    const Batch upperZ = Batch::Set(input.UpperZ);
+    const Vec points[4] = {
+        {Batch::Load(input.LowerX + i), Batch::Load(input.LowerY + i), lowerZ},
+        {Batch::Load(input.UpperX + i), Batch::Load(input.UpperY + i), upperZ},
+        {Batch::Load(input.LowerX + i + 1), Batch::Load(input.LowerY + i + 1),
+         lowerZ},
+        {Batch::Load(input.UpperX + i + 1), Batch::Load(input.UpperY + i + 1),
+         upperZ}};
+    // indices into points, wound counter-clockwise seen from outside
+    static const int TRIANGLES[2][3] = {{0, 2, 1}, {1, 2, 3}};
+
+    // vertex normals in the order of points
+    const bool isAnalytic = input.LowerNormal[0] != nullptr;
+    Vec normals[4];
+    if (isAnalytic) {
+        auto load = [i](const float* const* normal, RingKernel::SizeType j) {
+            return Vec{Batch::Load(normal[0] + i + j),
+                       Batch::Load(normal[1] + i + j),
+                       Batch::Load(normal[2] + i + j)};
+        };
+        normals[0] = load(input.LowerNormal, 0);
+        normals[1] = load(input.UpperNormal, 0);
+        normals[2] = load(input.LowerNormal, 1);
+        normals[3] = load(input.UpperNormal, 1);
+    }
+
+    const Vec viewPoint = Vec::Set(input.ViewPoint);
+    for (auto t = 0; t < 2; t++) {
+        const auto& triangle = TRIANGLES[t];
+        Vec normal;
+        if (isAnalytic) {
+            // culling only needs the sign, so the sum stays unnormalized
+            normal = normals[triangle[0]] + normals[triangle[1]] +
+                     normals[triangle[2]];
+        } else {
+            normal = FaceNormal(points[triangle[0]], points[triangle[1]],
+                                points[triangle[2]]);
+            normal.X.Store(output.NormalX[t] + i);
+            normal.Y.Store(output.NormalY[t] + i);
+            normal.Z.Store(output.NormalZ[t] + i);
+        }
+
+        const Batch visible =
+            input.Cull ? Batch::ToFloat(Batch::Greater(
+                             Vec::Dot(viewPoint, normal), Batch::Set(0)))
+                       : Batch::Set(1);
+        visible.Store(output.Visible[t] + i);
+
+        if (input.Shade) {
+            for (auto v = 0; v < 3; v++) {
+                Intensity(input, points[triangle[v]],
+                          isAnalytic ? normals[triangle[v]] : normal)
+                    .Store(output.Intensity[t][v] + i);
+            }
+        }
+    }
+}
+
+// whole batches first, the tail one quad at a time
+template <typename Batch>
+void RunKernel(const RingKernel::Input& input,
+               const RingKernel::Output& output) {
+    RingKernel::SizeType i = 0;
+    for (; i + Batch::SIZE <= input.Count; i += Batch::SIZE) {
+        RunBatch<Batch>(input, output, i);
+    }
+    for (; i < input.Count; i++) {
+        RunBatch<ScalarBatch>(input, output, i);
+    }
+}
+
+}  // namespace
+
+#endif  // CG_LAB_RINGKERNELIMPL_HPP_
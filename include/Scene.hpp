@@ -0,0 +1,129 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_SCENE_HPP_
+#define CG_LAB_SCENE_HPP_
+
+#include <Ellipsoid.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// One object of an instanced scene. The shared unit sphere mesh is
+// scaled by the semi-axes, rotated by the unit quaternion and moved
+// to the position in the vertex shader. The color replaces the one
+// of the mesh.
+struct Instance {
+    float Position[3];
+    float Axes[3];
+    // x, y, z, w
+    float Rotation[4];
+    std::uint8_t Color[4];
+};
+
+static_assert(sizeof(Instance) == 44, "instance is padded");
+
+// SINGLE draws the one ellipsoid of the widget, INSTANCED every object
+// of its scene with the unit mesh
+enum class SceneMode { SINGLE, INSTANCED };
+
+// axis-aligned box
+struct Bounds {
+    Vec3 Center;
+    Vec3 Extent;
+
+    static Bounds Merge(const Bounds& first, const Bounds& second);
+};
+
+// Clip volume of a transform, in the space of the points it is applied
+// to. Points are row vectors, as in the shaders.
+class Frustum {
+public:
+    enum class Side { OUTSIDE, INTERSECTS, INSIDE };
+
+    explicit Frustum(const Mat4x4& transform);
+
+    Side Classify(const Bounds& bounds) const;
+
+private:
+    static const SizeType PLANE_COUNT = 6;
+
+    // dot(plane, (point, 1)) >= 0 inside
+    std::array<Vec4, PLANE_COUNT> Planes;
+};
+
+// Ellipsoids drawn with one mesh, see MeshBuffer::DrawInstanced.
+// A bounding volume hierarchy over the instances is rebuilt on the
+// first cull after a change, Cull walks it and skips the subtrees
+// outside the frustum and tests nothing below the ones inside it.
+class Scene {
+public:
+    struct CullStats {
+        SizeType Visible = 0;
+        SizeType Culled = 0;
+        // boxes classified against the frustum, nodes and instances
+        SizeType Tests = 0;
+    };
+
+    Scene() = default;
+
+    void Add(const Instance& instance);
+    void Clear();
+
+    // fills visible with the instances in the clip volume of transform,
+    // ordered by the hierarchy
+    CullStats Cull(const Mat4x4& transform, std::vector<Instance>& visible);
+
+    const std::vector<Instance>& GetInstances() const { return Instances; }
+    SizeType GetInstanceCount() const { return Instances.size(); }
+    bool IsEmpty() const { return Instances.empty(); }
+
+    // The mesh every instance is drawn with. Side layers only reach
+    // Ellipsoid::GetMaxHeight(), so it is the closed ellipsoid with
+    // semi-axes (1, 1, GetMaxHeight()), and scaling by GetUnitScale
+    // turns it into the unit sphere.
+    static Ellipsoid GetUnitEllipsoid(SizeType vertexCount,
+                                      SizeType surfaceCount,
+                                      const Vec3& viewPoint);
+    static Vec3 GetUnitScale();
+    // random axes, orientations and colors on a jittered grid, all of
+    // it inside the sphere of the given radius, so it stays in the
+    // clip volume whatever the rotation
+    static Scene Generate(SizeType count, float radius, unsigned seed);
+    // tight box of the rotated and scaled ellipsoid
+    static Bounds GetBounds(const Instance& instance);
+
+private:
+    static const SizeType LEAF_SIZE = 4;
+
+    // children of an inner node are the next node and Second,
+    // leaves own Count sorted instances starting at First
+    struct Node {
+        Bounds Box;
+        SizeType First;
+        SizeType Count;
+        SizeType Second;
+    };
+
+    void BuildIndex();
+    SizeType BuildNode(SizeType first, SizeType count);
+    void CullNode(const Frustum& frustum,
+                  SizeType node,
+                  std::vector<Instance>& visible,
+                  CullStats& stats) const;
+    void AddNode(SizeType node, std::vector<Instance>& visible) const;
+
+    std::vector<Instance> Instances;
+    std::vector<Node> Nodes;
+    // build state, the instances in the order of the tree
+    std::vector<SizeType> Order;
+    std::vector<Bounds> InstanceBounds;
+    std::vector<Instance> SortedInstances;
+    std::vector<Bounds> SortedBounds;
+    bool IsIndexed = false;
+};
+
+#endif  // CG_LAB_SCENE_HPP_
@@ -0,0 +1,117 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_THREADPOOL_HPP_
+#define CG_LAB_THREADPOOL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool. Every worker owns a task queue, takes work
+// from its back and steals from the front of the other queues when idle.
+class ThreadPool {
+public:
+    using SizeType = std::size_t;
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(SizeType threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    SizeType GetThreadCount() const { return Workers.size(); }
+
+    void Submit(Task task);
+
+    // Calls function(begin, end) for consecutive chunks of [0, count)
+    // and returns when all chunks are done. The calling thread helps.
+    // The first exception a chunk throws is rethrown here once all
+    // chunks are done.
+    template <typename Function>
+    void ParallelFor(SizeType count, SizeType chunkSize, Function&& function);
+
+    // pool sized to hardware concurrency, shared by the whole program
+    static ThreadPool& GetInstance();
+    // Replaces the shared pool. Only safe while nothing runs on it,
+    // meant for benchmarks sweeping thread counts.
+    static void SetInstanceThreadCount(SizeType threadCount);
+
+private:
+    struct Queue {
+        std::mutex Mutex;
+        std::deque<Task> Tasks;
+    };
+
+    static std::unique_ptr<ThreadPool>& GetInstancePointer();
+
+    bool PopTask(SizeType index, Task& task);
+    bool RunPendingTask(SizeType index);
+    void WorkerLoop(SizeType index);
+
+    std::vector<std::unique_ptr<Queue>> Queues;
+    std::vector<std::thread> Workers;
+    std::mutex WakeMutex;
+    std::condition_variable WakeCondition;
+    std::atomic<SizeType> PendingCount;
+    std::atomic<SizeType> NextQueue;
+    bool IsStopping;
+};
+
+template <typename Function>
+void ThreadPool::ParallelFor(SizeType count,
+                             SizeType chunkSize,
+                             Function&& function) {
+    if (count == 0) {
+        return;
+    }
+
+    chunkSize = std::max<SizeType>(chunkSize, 1);
+    SizeType remaining = (count + chunkSize - 1) / chunkSize;
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    std::exception_ptr error;
+
+    for (SizeType begin = 0; begin < count; begin += chunkSize) {
+        const auto end = std::min(begin + chunkSize, count);
+        Submit([&, begin, end]() {
+            std::exception_ptr chunkError;
+            try {
+                function(begin, end);
+            } catch (...) {
+                chunkError = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (chunkError && !error) {
+                error = chunkError;
+            }
+            if (--remaining == 0) {
+                doneCondition.notify_all();
+            }
+        });
+    }
+
+    // index past the last queue: the caller only steals
+    while (RunPendingTask(Queues.size())) {
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&remaining]() { return remaining == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif  // CG_LAB_THREADPOOL_HPP_
@@ -17,26 +17,51 @@ public:
     using FloatType = float;
     using IntType = std::int32_t;
 
+    using Vec3 = Eigen::Matrix<float, 1, 3>;
     using Vec4 = Eigen::Matrix<float, 1, 4>;
 
     Vertex() : Vertex{0.0, 0.0, 0.0, 1.0} {}
     Vertex(FloatType x, FloatType y) : Vertex{x, y, 0.0, 1.0} {}
     Vertex(FloatType x, FloatType y, FloatType z) : Vertex{x, y, z, 1.0} {}
+    // no normal unless one is given, it is uploaded either way
     Vertex(FloatType x, FloatType y, FloatType z, FloatType h)
-        : Position{x, y, z, h} {}
-    Vertex(const Vec4& position) { ToArray(position, Position); }
-    Vertex(const Vec4& position, const Vec4& color) {
+        : Position{x, y, z, h}, Normal{} {}
+    Vertex(const Vec4& position) : Normal{} { ToArray(position, Position); }
+    Vertex(const Vec4& position, const Vec4& color) : Normal{} {
         ToArray(position, Position);
         ToArray(color, Color);
     }
+    Vertex(const Vec4& position, const Vec4& color, const Vec3& normal)
+        : Vertex{position, color} {
+        SetNormal(normal);
+    }
+
+    // xyzw position, rgba color and xyz normal, skips Eigen temporaries
+    Vertex(const FloatType* position,
+           const FloatType* color,
+           const FloatType* normal) noexcept {
+        std::memcpy(Position, position, sizeof(Position));
+        std::memcpy(Color, color, sizeof(Color));
+        std::memcpy(Normal, normal, sizeof(FloatType) * 3);
+        Normal[3] = 0;
+    }
 
     Vertex(Vertex&& v) = default;
     Vertex(const Vertex& v) = default;
 
     void SetColor(const Vec4& color) noexcept { ToArray(color, Color); }
+    void SetNormal(const Vec3& normal) noexcept {
+        ToArray(Vec4(normal[0], normal[1], normal[2], 0), Normal);
+    }
 
     Vec4 GetPosition() const noexcept { return ToVec4(Position); }
     Vec4 GetColor() const noexcept { return ToVec4(Color); }
+    Vec4 GetNormal() const noexcept { return ToVec4(Normal); }
+
+    // xyzw arrays, skip Eigen temporaries like the raw constructor
+    const FloatType* GetPositionData() const noexcept { return Position; }
+    const FloatType* GetColorData() const noexcept { return Color; }
+    const FloatType* GetNormalData() const noexcept { return Normal; }
 
     static constexpr IntType GetPositionTupleSize() noexcept {
         return POSITION_TUPLE_SIZE;
@@ -46,6 +71,10 @@ public:
         return COLOR_TUPLE_SIZE;
     }
 
+    static constexpr IntType GetNormalTupleSize() noexcept {
+        return NORMAL_TUPLE_SIZE;
+    }
+
     static constexpr IntType GetPositionOffset() noexcept {
         return offsetof(Vertex, Position);
     }
@@ -54,11 +83,16 @@ public:
         return offsetof(Vertex, Color);
     }
 
+    static constexpr IntType GetNormalOffset() noexcept {
+        return offsetof(Vertex, Normal);
+    }
+
     static constexpr IntType GetStride() noexcept { return sizeof(Vertex); }
 
 private:
     static const IntType POSITION_TUPLE_SIZE = 3;
     static const IntType COLOR_TUPLE_SIZE = 4;
+    static const IntType NORMAL_TUPLE_SIZE = 3;
 
     static Vec4 ToVec4(const FloatType* vec) {
         return Vec4(vec[0], vec[1], vec[2], vec[3]);
@@ -70,6 +104,7 @@ private:
 
     FloatType Position[4];
     FloatType Color[4];
+    FloatType Normal[4];
 };
 
 #endif  // CG_LAB_VERTEX_HPP_
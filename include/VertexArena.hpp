@@ -0,0 +1,79 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#ifndef CG_LAB_VERTEXARENA_HPP_
+#define CG_LAB_VERTEXARENA_HPP_
+
+#include <Vertex.hpp>
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Uninitialized storage for Vertex, freed as a whole
+class VertexBlock {
+public:
+    using SizeType = std::size_t;
+
+    explicit VertexBlock(SizeType capacity);
+
+    Vertex* GetData() { return Data.get(); }
+    const Vertex* GetData() const { return Data.get(); }
+    SizeType GetCapacity() const { return Capacity; }
+
+private:
+    struct Deleter {
+        void operator()(Vertex* data) const { ::operator delete(data); }
+    };
+
+    std::unique_ptr<Vertex, Deleter> Data;
+    SizeType Capacity;
+};
+
+// Storage reused from one rebuild to the next. Vertex blocks are double
+// buffered: a rebuild writes to the block the mesh on screen does not
+// hold, and grows it only when the tessellation needs more room. If
+// both are still held, the rebuild gets a block of its own.
+// Acquire is meant for one thread at a time, GetStats for any thread.
+class VertexArena {
+public:
+    using SizeType = std::size_t;
+    using BlockPointer = std::shared_ptr<VertexBlock>;
+
+    struct Stats {
+        // fresh blocks and bytes taken from the heap
+        SizeType Allocations = 0;
+        SizeType AllocatedBytes = 0;
+        // rebuilds served by an existing block
+        SizeType Reuses = 0;
+        // bytes held by the arena itself
+        SizeType ReservedBytes = 0;
+    };
+
+    VertexArena() = default;
+    VertexArena(const VertexArena&) = delete;
+    VertexArena& operator=(const VertexArena&) = delete;
+
+    BlockPointer Acquire(SizeType capacity);
+    // generation scratch, valid until the next call
+    float* AcquireScratch(SizeType size);
+
+    Stats GetStats() const;
+
+private:
+    static constexpr SizeType BLOCK_COUNT = 2;
+
+    void CountAllocation(SizeType bytes);
+    void UpdateReserved();
+
+    std::array<BlockPointer, BLOCK_COUNT> Blocks;
+    std::vector<float> Scratch;
+    mutable std::mutex StatsMutex;
+    Stats Counters;
+};
+
+#endif  // CG_LAB_VERTEXARENA_HPP_
@@ -0,0 +1,40 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#version 330
+attribute highp vec4 position;
+attribute highp vec3 normal;
+attribute highp vec3 instancePosition;
+attribute highp vec3 instanceAxes;
+attribute highp vec4 instanceRotation;
+attribute lowp vec4 instanceColor;
+
+uniform highp mat4x4 transformMatrix;
+uniform highp mat4x4 rotateMatrix;
+// turns the shared mesh into the unit sphere
+uniform highp vec3 meshScale;
+
+varying lowp vec4 vColor;
+varying highp vec3 vPoint;
+varying highp vec3 vNormal;
+
+// by the unit quaternion q
+highp vec3 rotate(highp vec4 q, highp vec3 v) {
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+    highp vec3 scale = meshScale * instanceAxes;
+    highp vec4 point =
+        vec4(rotate(instanceRotation, position.xyz * scale) + instancePosition,
+             1.0);
+    // inverse transpose of the scale, the rotation is orthogonal
+    highp vec3 objectNormal = rotate(instanceRotation, normal / scale);
+
+    vColor = instanceColor;
+    vPoint = (point * rotateMatrix).xyz;
+    vNormal = (vec4(objectNormal, 0.0) * rotateMatrix).xyz;
+    gl_Position = point * transformMatrix;
+}
@@ -0,0 +1,32 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#version 330
+uniform highp float ambientCoeff;
+uniform highp float specularCoeff;
+uniform highp float diffuseCoeff;
+uniform highp float shineCoeff;
+uniform highp vec3 light;
+uniform highp vec3 toObserver;
+
+varying lowp vec4 vColor;
+varying highp vec3 vPoint;
+varying highp vec3 vNormal;
+
+void main() {
+    highp vec3 normal = normalize(vNormal);
+    highp vec3 color = vColor.rgb;
+    highp vec3 toLight = light - vPoint;
+
+    highp vec3 ambientI = ambientCoeff * color;
+    highp vec3 diffuseI =
+        diffuseCoeff * max(dot(toLight, normal), 0.0) * color;
+    highp vec3 reflectedLight = 2.0 * dot(normal, toLight) * normal - toLight;
+    highp vec3 specularI =
+        specularCoeff *
+        pow(max(dot(reflectedLight, toObserver), 0.0), shineCoeff) * color;
+
+    gl_FragColor = vec4(ambientI + diffuseI + specularI, 1.0);
+}
@@ -0,0 +1,23 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#version 330
+attribute highp vec4 position;
+attribute lowp vec4 color;
+attribute highp vec3 normal;
+
+uniform highp mat4x4 transformMatrix;
+uniform highp mat4x4 rotateMatrix;
+
+varying lowp vec4 vColor;
+varying highp vec3 vPoint;
+varying highp vec3 vNormal;
+
+void main() {
+    vColor = color;
+    vPoint = (position * rotateMatrix).xyz;
+    vNormal = (vec4(normal, 0.0) * rotateMatrix).xyz;
+    gl_Position = position * transformMatrix;
+}
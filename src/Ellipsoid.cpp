@@ -1,168 +1,561 @@
 #include <Ellipsoid.hpp>
+#include <RingKernel.hpp>
+#include <ThreadPool.hpp>
 
 #include <algorithm>
 #include <cmath>
-#include <future>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <utility>
 #include <vector>
 
-const float Layer::PI = 4 * std::atan(1.0f);
+const float RingTable::PI = 4 * std::atan(1.0f);
+const Vec4 Ellipsoid::BASE_COLOR = Vec4(0, 0, 1, 1);
 
 Vec4 Lighting::Calculate(const Vec3& point,
                          const Vec3& normal,
                          const Vec3& color) const {
-    Vec3 ambientI = AmbientCoeff * color;
-    Vec3 fromPointToLightVec = Light - point;
-    Vec3 diffuseI =
-        DiffuseCoeff * std::max(fromPointToLightVec.dot(normal), 0.0f) * color;
-    float shineCoeff = 10;
-    Vec3 reflectedLightVec =
-        2 * normal.dot(fromPointToLightVec) * normal - fromPointToLightVec;
-    Vec3 specularI =
-        SpecularCoeff *
-        std::pow(reflectedLightVec.dot(ToObserverVec), shineCoeff) * color;
-
-    Vec3 sum = ambientI + diffuseI + specularI;
+    Vec3 sum = CalculateIntensity(point, normal) * color;
     return Vec4(sum[0], sum[1], sum[2], 1);
 }
 
-Layer::Layer(LenghtType a,
-             LenghtType b,
-             LenghtType c,
-             LenghtType h,
+float Lighting::CalculateIntensity(const Vec3& point,
+                                   const Vec3& normal) const {
+    float result = 0;
+    CalculateIntensities(point.data(), 0, normal.data(), 0, 1, &result);
+    return result;
+}
+
+void Lighting::CalculateIntensities(const float* points,
+                                    SizeType pointStride,
+                                    const float* normals,
+                                    SizeType normalStride,
+                                    SizeType count,
+                                    float* result) const {
+    static const auto functions = GetIntensityFunctions(
+        std::make_integer_sequence<unsigned, MAX_SHINE_COEFF + 1>());
+    (this->*functions[ShineCoeff])(points, pointStride, normals, normalStride,
+                                   count, result);
+}
+
+template <unsigned Exponent>
+float Lighting::Power(float base) {
+    if constexpr (Exponent == 0) {
+        return 1;
+    } else if constexpr (Exponent % 2 != 0) {
+        return base * Power<Exponent - 1>(base);
+    } else {
+        const float half = Power<Exponent / 2>(base);
+        return half * half;
+    }
+}
+
+template <unsigned ShineExponent>
+void Lighting::BatchIntensities(const float* points,
+                                SizeType pointStride,
+                                const float* normals,
+                                SizeType normalStride,
+                                SizeType count,
+                                float* result) const {
+    for (auto i = 0UL; i < count; i++) {
+        const float* point = points + i * pointStride;
+        const float* normal = normals + i * normalStride;
+
+        float toLight[3];
+        for (auto c = 0; c < 3; c++) {
+            toLight[c] = Light[c] - point[c];
+        }
+        const float dot = toLight[0] * normal[0] + toLight[1] * normal[1] +
+                          toLight[2] * normal[2];
+        float reflected = 0;
+        for (auto c = 0; c < 3; c++) {
+            reflected += (2 * dot * normal[c] - toLight[c]) * ToObserverVec[c];
+        }
+
+        // light reflected away from the observer adds no highlight,
+        // like in the lighting shader
+        result[i] = AmbientCoeff + DiffuseCoeff * std::max(dot, 0.0f) +
+                    SpecularCoeff *
+                        Power<ShineExponent>(std::max(reflected, 0.0f));
+    }
+}
+
+template <unsigned... Exponents>
+const Lighting::IntensityFunction* Lighting::GetIntensityFunctions(
+    std::integer_sequence<unsigned, Exponents...>) {
+    static const IntensityFunction functions[] = {
+        &Lighting::BatchIntensities<Exponents>...};
+    return functions;
+}
+
+Lighting Lighting::ToObjectSpace(const Mat4x4& rotateMatrix) const {
+    // rotation is orthonormal, so its transpose maps world to object space
+    const Mat4x4 inverse = rotateMatrix.transpose();
+    Vec4 light = Vec4(Light[0], Light[1], Light[2], 0) * inverse;
+    Vec4 toObserver =
+        Vec4(ToObserverVec[0], ToObserverVec[1], ToObserverVec[2], 0) *
+        inverse;
+    return Lighting(AmbientCoeff, SpecularCoeff, DiffuseCoeff,
+                    Vec3(light[0], light[1], light[2]),
+                    Vec3(toObserver[0], toObserver[1], toObserver[2]),
+                    ShineCoeff);
+}
+
+RingTable::RingTable(SizeType n) : Size{n}, Cosines(n + 1), Sines(n + 1) {
+    const auto DELTA_PHI = 2 * PI / n;
+    for (auto i = 0UL; i <= n; i++) {
+        Cosines[i] = std::cos(i * DELTA_PHI);
+        Sines[i] = std::sin(i * DELTA_PHI);
+    }
+}
+
+ObjectMesh::ObjectMesh(LenghtType a,
+                       LenghtType b,
+                       LenghtType c,
+                       const std::vector<LenghtType>& heights,
+                       const RingTable& ring)
+    : RingSize{ring.GetSize()} {
+    Rings.reserve(heights.size());
+    for (auto h : heights) {
+        auto result = std::make_shared<ObjectRing>();
+        GenerateRing(a, b, c, h, ring, nullptr, nullptr, *result);
+        Rings.push_back(std::move(result));
+    }
+}
+
+SizeType ObjectMesh::GenerateRing(LenghtType a,
+                                  LenghtType b,
+                                  LenghtType c,
+                                  LenghtType height,
+                                  const RingTable& ring,
+                                  const ObjectRing* previous,
+                                  const RingTable* previousRing,
+                                  ObjectRing& result) {
+    const auto n = ring.GetSize();
+    const auto previousSize = previous != nullptr ? previousRing->GetSize() : 0;
+    result.Height = height;
+    result.Points.resize(n);
+    result.Normals.resize(n);
+    result.X.resize(n + 1);
+    result.Y.resize(n + 1);
+    result.NormalX.resize(n + 1);
+    result.NormalY.resize(n + 1);
+    result.NormalZ.resize(n + 1);
+
+    // rings are scaled by sqrt(c^2 - h^2), so the surface is the
+    // ellipsoid with semi-axes (a * c, b * c, c)
+    const auto AC = a * c;
+    const auto BC = b * c;
+    const auto h = height;
+    const auto C = (c * c - h * h) / c * c;
+    const auto A = std::sqrt(C) * a;
+    const auto B = std::sqrt(C) * b;
+
+    SizeType copied = 0;
+    for (auto i = 0UL; i < n; i++) {
+        // same angle only if the tables agree to the last bit,
+        // so the result does not depend on what was cached
+        const auto j = i * previousSize / n;
+        if (previous != nullptr && i * previousSize % n == 0 &&
+            previousRing->Cos(j) == ring.Cos(i) &&
+            previousRing->Sin(j) == ring.Sin(i)) {
+            result.Points[i] = previous->Points[j];
+            result.Normals[i] = previous->Normals[j];
+            copied++;
+        } else {
+            Vec4 point = Vec4(A * ring.Cos(i), B * ring.Sin(i), h, 1);
+            Vec4 normal = Vec4(point[0] / (AC * AC), point[1] / (BC * BC),
+                               point[2] / (c * c), 0);
+            normal.normalize();
+            result.Points[i] = point;
+            result.Normals[i] = normal;
+        }
+        result.X[i] = result.Points[i][0];
+        result.Y[i] = result.Points[i][1];
+        result.NormalX[i] = result.Normals[i][0];
+        result.NormalY[i] = result.Normals[i][1];
+        result.NormalZ[i] = result.Normals[i][2];
+    }
+    for (auto array : {&result.X, &result.Y, &result.NormalX, &result.NormalY,
+                       &result.NormalZ}) {
+        (*array)[n] = (*array)[0];
+    }
+    return copied;
+}
+
+SizeType ObjectMesh::GetMemorySize() const {
+    SizeType bytes = Rings.size() * sizeof(RingPointer);
+    for (auto&& ring : Rings) {
+        bytes += sizeof(ObjectRing) +
+                 (ring->Points.size() + ring->Normals.size()) * sizeof(Vec4) +
+                 (ring->X.size() + ring->Y.size() + ring->NormalX.size() +
+                  ring->NormalY.size() + ring->NormalZ.size()) *
+                     sizeof(float);
+    }
+    return bytes;
+}
+
+ObjectMesh TessellationCache::Generate(LenghtType a,
+                                       LenghtType b,
+                                       LenghtType c,
+                                       const std::vector<LenghtType>& heights,
+                                       const RingTable& ring) {
+    if (a != A || b != B || c != C) {
+        Clear();
+        A = a;
+        B = b;
+        C = c;
+    }
+    const bool isSameSize = ring.GetSize() == Ring.GetSize();
+
+    // only the rings of this mesh are kept for the next one
+    std::unordered_map<std::uint32_t, ObjectMesh::RingPointer> rings;
+    std::vector<ObjectMesh::RingPointer> meshRings;
+    meshRings.reserve(heights.size());
+    for (auto h : heights) {
+        const auto key = GetKey(h);
+        const auto found = Rings.find(key);
+        ObjectMesh::RingPointer result;
+        if (found != Rings.end() && isSameSize) {
+            Counters.RingHits++;
+            result = found->second;
+        } else {
+            Counters.RingMisses++;
+            const auto previous =
+                found != Rings.end() ? found->second.get() : nullptr;
+            auto generated = std::make_shared<ObjectRing>();
+            const auto copied = ObjectMesh::GenerateRing(
+                a, b, c, h, ring, previous, &Ring, *generated);
+            Counters.PointHits += copied;
+            Counters.PointMisses += ring.GetSize() - copied;
+            result = std::move(generated);
+        }
+        rings.emplace(key, result);
+        meshRings.push_back(std::move(result));
+    }
+
+    Rings = std::move(rings);
+    if (!isSameSize) {
+        Ring = ring;
+    }
+    return ObjectMesh(ring.GetSize(), std::move(meshRings));
+}
+
+void TessellationCache::Clear() {
+    Rings.clear();
+    Ring = RingTable();
+}
+
+std::uint32_t TessellationCache::GetKey(LenghtType height) {
+    // exact bits, a ring is only valid for the very same height
+    std::uint32_t key = 0;
+    static_assert(sizeof(key) == sizeof(height), "float is not 32 bit");
+    std::memcpy(&key, &height, sizeof(key));
+    return key;
+}
+
+Layer::Layer(const ObjectMesh& mesh,
+             SizeType k,
+             LayerType type,
+             const Vec3& viewPoint,
+             const Lighting& lighting,
+             ShadingMode shading,
+             CullingMode culling,
+             NormalMode normals)
+    : Type{type}, Culling{culling} {
+    // kernel output, reused by every layer built on this thread
+    thread_local std::vector<float> scratch;
+    scratch.resize(GetScratchSize(mesh));
+
+    Vertices.reserve(Prepare(mesh, k, type, viewPoint, lighting, shading,
+                             culling, normals, scratch.data()));
+    Interleave(mesh, k, type, shading, normals, scratch.data(),
+               [this](const float* point, const float* color,
+                      const float* normal) {
+                   Vertices.emplace_back(point, color, normal);
+               });
+}
+
+Layer::Layer(const VertexVector& pool,
+             SizeType lower,
+             SizeType upper,
              SizeType n,
-             LenghtType deltaH,
-             const Mat4x4& transformMatrix,
              const Vec3& viewPoint,
-             const Lighting& lighting)
-    : Type{LayerType::SIDE} {
-    GenerateVertices(a, b, c, h, n, deltaH, transformMatrix, viewPoint,
-                     lighting);
+             CullingMode culling,
+             Topology topology)
+    : Type{LayerType::SIDE}, Culling{culling}, Indexed{true} {
+    if (topology == Topology::STRIP) {
+        // upper ring first keeps the triangles counter-clockwise,
+        // the last pair closes the band
+        IndexVector strip;
+        strip.reserve(2 * n + 2);
+        for (auto i = 0UL; i <= n; i++) {
+            strip.push_back(static_cast<IndexType>(upper + i % n));
+            strip.push_back(static_cast<IndexType>(lower + i % n));
+        }
+        AddStrip(pool, strip, viewPoint);
+        return;
+    }
+
+    for (auto i = 0UL; i < n; i++) {
+        auto j = (i + 1) % n;
+        auto first = static_cast<IndexType>(lower + i);
+        auto second = static_cast<IndexType>(upper + i);
+        auto third = static_cast<IndexType>(lower + j);
+        auto fourth = static_cast<IndexType>(upper + j);
+
+        AddTriangle(pool, first, third, second, viewPoint);
+        AddTriangle(pool, second, third, fourth, viewPoint);
+    }
 }
 
-Layer::Layer(LenghtType a,
-             LenghtType b,
-             LenghtType c,
-             LenghtType h,
+Layer::Layer(const VertexVector& pool,
+             SizeType center,
              SizeType n,
-             const Mat4x4& transformMatrix,
              const Vec3& viewPoint,
-             const Lighting& lighting)
-    : Type{LayerType::BOTTOM} {
-    GenerateVertices(a, b, c, h, n, transformMatrix, viewPoint, lighting);
+             CullingMode culling,
+             Topology topology)
+    : Type{LayerType::BOTTOM}, Culling{culling}, Indexed{true} {
+    const auto ring = center + 1;
+    const bool isTop = pool[center].GetPosition()[2] > 0;
+    if (topology == Topology::STRIP) {
+        // Zigzags between both ends of the ring: 0, n - 1, 1, n - 2...
+        // The ring is convex, so that covers the cap, and a fan would
+        // need a draw of its own.
+        IndexVector strip = {static_cast<IndexType>(ring)};
+        strip.reserve(n);
+        auto low = 1UL;
+        auto high = n - 1;
+        for (bool isHigh = !isTop; low <= high; isHigh = !isHigh) {
+            strip.push_back(
+                static_cast<IndexType>(ring + (isHigh ? high-- : low++)));
+        }
+        AddStrip(pool, strip, viewPoint);
+        return;
+    }
+
+    for (auto i = 0UL; i < n; i++) {
+        auto first = static_cast<IndexType>(ring + i);
+        auto second = static_cast<IndexType>(ring + (i + 1) % n);
+        // the top cap is seen from above, so its rings run the other way
+        if (isTop) {
+            std::swap(first, second);
+        }
+        AddTriangle(pool, first, static_cast<IndexType>(center), second,
+                    viewPoint);
+    }
 }
 
 const VertexVector& Layer::GetVertices() const {
     return Vertices;
 }
 
-SizeType Layer::GetItemsCount() const {
-    return Vertices.size();
+const IndexVector& Layer::GetIndices() const {
+    return Indices;
 }
 
-Layer Layer::ApplyMatrix(const Mat4x4& matrix) const {
-    Layer layer;
-    for (auto&& vertex : Vertices) {
-        layer.Vertices.emplace_back(vertex.GetPosition() * matrix,
-                                    vertex.GetColor());
-    }
-    return layer;
+SizeType Layer::GetItemsCount() const {
+    return Indexed ? Indices.size() : Vertices.size();
 }
 
-void Layer::GenerateVertices(LenghtType a,
-                             LenghtType b,
-                             LenghtType c,
-                             LenghtType h,
-                             SizeType n,
-                             LenghtType deltaH,
-                             const Mat4x4& transformMatrix,
-                             const Vec3& viewPoint,
-                             const Lighting& lighting) {
-    const auto DELTA_PHI = 2 * PI / n;
+SizeType Layer::GetScratchSize(const ObjectMesh& mesh) {
+    return KERNEL_ARRAY_COUNT * mesh.GetRingSize();
+}
 
-    auto generateVertex = [a, b, c, DELTA_PHI](auto&& i, auto&& h) {
-        const auto C = (c * c - h * h) / c * c;
-        const auto A = std::sqrt(C) * a;
-        const auto B = std::sqrt(C) * b;
-        return Vertex(A * std::cos(i * DELTA_PHI), B * std::sin(i * DELTA_PHI),
-                      h);
-    };
+SizeType Layer::Prepare(const ObjectMesh& mesh,
+                        SizeType k,
+                        LayerType type,
+                        const Vec3& viewPoint,
+                        const Lighting& lighting,
+                        ShadingMode shading,
+                        CullingMode culling,
+                        NormalMode normals,
+                        float* scratch) {
+    const auto n = mesh.GetRingSize();
+    const auto output = MapScratch(scratch, n);
+    SizeType triangleCount = 0;
+
+    if (type == LayerType::SIDE) {
+        const auto& light = lighting.GetLight();
+        const auto& toObserver = lighting.GetToObserverVec();
+        RingKernel::Input input = {
+            mesh.GetRingX(k),
+            mesh.GetRingY(k),
+            mesh.GetHeight(k),
+            mesh.GetRingX(k + 1),
+            mesh.GetRingY(k + 1),
+            mesh.GetHeight(k + 1),
+            n,
+            {nullptr, nullptr, nullptr},
+            {nullptr, nullptr, nullptr},
+            {viewPoint[0], viewPoint[1], viewPoint[2]},
+            {light[0], light[1], light[2]},
+            {toObserver[0], toObserver[1], toObserver[2]},
+            lighting.GetAmbientCoeff(),
+            lighting.GetSpecularCoeff(),
+            lighting.GetDiffuseCoeff(),
+            lighting.GetShineCoeff(),
+            culling == CullingMode::CPU,
+            shading == ShadingMode::CPU};
+        if (normals == NormalMode::ANALYTIC) {
+            for (auto ring : {0, 1}) {
+                auto target = ring == 0 ? input.LowerNormal : input.UpperNormal;
+                target[0] = mesh.GetRingNormalX(k + ring);
+                target[1] = mesh.GetRingNormalY(k + ring);
+                target[2] = mesh.GetRingNormalZ(k + ring);
+            }
+        }
+        RingKernel::Run(input, output);
 
-    const auto BLUE = Vec4(0, 0, 1, 1);
-    Vec4 color = BLUE;
+        for (auto t = 0; t < 2; t++) {
+            for (auto i = 0UL; i < n; i++) {
+                triangleCount += output.Visible[t][i] != 0;
+            }
+        }
+        return 3 * triangleCount;
+    }
 
+    // caps are a fraction of the mesh and stay scalar
+    const Vec4 center = Vec4(0, 0, mesh.GetHeight(k), 1);
+    // the top cap is seen from above, so its rings run the other way
+    const bool isTop = center[2] > 0;
     for (auto i = 0UL; i < n; i++) {
-        auto first = generateVertex(i, h).GetPosition() * transformMatrix;
-        auto second =
-            generateVertex(i, h + deltaH).GetPosition() * transformMatrix;
-        auto third = generateVertex(i + 1, h).GetPosition() * transformMatrix;
-        auto fourth =
-            generateVertex(i + 1, h + deltaH).GetPosition() * transformMatrix;
-
-        Vec3 normal = GetNormal(first, second, third);
-        if (CheckNormal(normal, viewPoint)) {
-            Vertices.emplace_back(
-                first,
-                lighting.Calculate(ToVec3(first), normal, ToVec3(color)));
-            Vertices.emplace_back(
-                second,
-                lighting.Calculate(ToVec3(second), normal, ToVec3(color)));
-            Vertices.emplace_back(
-                third,
-                lighting.Calculate(ToVec3(third), normal, ToVec3(color)));
-        }
+        const Vec3 normal =
+            GetNormal(mesh.GetPoint(k, isTop ? i + 1 : i), center,
+                      mesh.GetPoint(k, isTop ? i : i + 1));
+        const bool isVisible = CheckNormal(normal, viewPoint, culling);
+
+        output.NormalX[0][i] = normal[0];
+        output.NormalY[0][i] = normal[1];
+        output.NormalZ[0][i] = normal[2];
+        output.Visible[0][i] = isVisible ? 1 : 0;
+        triangleCount += isVisible;
+    }
 
-        normal = GetNormal(second, fourth, third);
-        if (CheckNormal(normal, viewPoint)) {
-            Vertices.emplace_back(
-                second,
-                lighting.Calculate(ToVec3(second), normal, ToVec3(color)));
-            Vertices.emplace_back(
-                fourth,
-                lighting.Calculate(ToVec3(fourth), normal, ToVec3(color)));
-            Vertices.emplace_back(
-                third,
-                lighting.Calculate(ToVec3(third), normal, ToVec3(color)));
+    if (shading == ShadingMode::CPU) {
+        // The cap is flat, every vertex is lit under the same normal:
+        // the ring is shaded once and shifted by one for the other end
+        // of each triangle.
+        const Vec3 normal = Vec3(0, 0, isTop ? 1 : -1);
+        float* ring = output.Intensity[0][isTop ? 2 : 0];
+        float* next = output.Intensity[0][isTop ? 0 : 2];
+        lighting.CalculateIntensities(mesh.GetPoint(k, 0).data(), 4,
+                                      normal.data(), 0, n, ring);
+        for (auto i = 0UL; i < n; i++) {
+            next[i] = ring[(i + 1) % n];
         }
+        std::fill(output.Intensity[0][1], output.Intensity[0][1] + n,
+                  lighting.CalculateIntensity(ToVec3(center), normal));
     }
+    return 3 * triangleCount;
 }
 
-void Layer::GenerateVertices(LenghtType a,
-                             LenghtType b,
-                             LenghtType c,
-                             LenghtType h,
-                             SizeType n,
-                             const Mat4x4& transformMatrix,
-                             const Vec3& viewPoint,
-                             const Lighting& lighting) {
-    const auto DELTA_PHI = 2 * PI / n;
+void Layer::Write(const ObjectMesh& mesh,
+                  SizeType k,
+                  LayerType type,
+                  ShadingMode shading,
+                  NormalMode normals,
+                  float* scratch,
+                  Vertex* out) {
+    Interleave(mesh, k, type, shading, normals, scratch,
+               [&out](const float* point, const float* color,
+                      const float* normal) {
+                   new (out++) Vertex(point, color, normal);
+               });
+}
 
-    auto generateVertex = [a, b, c, DELTA_PHI](auto&& i, auto&& h) {
-        const auto C = (c * c - h * h) / c * c;
-        const auto A = std::sqrt(C) * a;
-        const auto B = std::sqrt(C) * b;
-        return Vertex(A * std::cos(i * DELTA_PHI), B * std::sin(i * DELTA_PHI),
-                      h);
-    };
+RingKernel::Output Layer::MapScratch(float* scratch, SizeType n) {
+    auto take = [&scratch, n]() { return std::exchange(scratch, scratch + n); };
+
+    RingKernel::Output output;
+    for (auto t = 0; t < 2; t++) {
+        output.NormalX[t] = take();
+        output.NormalY[t] = take();
+        output.NormalZ[t] = take();
+        output.Visible[t] = take();
+        for (auto v = 0; v < 3; v++) {
+            output.Intensity[t][v] = take();
+        }
+    }
+    return output;
+}
 
-    const auto BLUE = Vec4(0, 0, 1, 1);
-    const Vec4 center = Vec4(0, 0, h, 1) * transformMatrix;
-    auto color = BLUE;
+template <typename Emit>
+void Layer::Interleave(const ObjectMesh& mesh,
+                       SizeType k,
+                       LayerType type,
+                       ShadingMode shading,
+                       NormalMode normals,
+                       float* scratch,
+                       Emit&& emit) {
+    // same order as the kernel: lower i, upper i, lower i + 1, upper i + 1
+    static const SizeType SIDE_TRIANGLES[2][3] = {{0, 2, 1}, {1, 2, 3}};
+
+    const auto n = mesh.GetRingSize();
+    const auto output = MapScratch(scratch, n);
+    const auto& baseColor = Ellipsoid::BASE_COLOR;
+    const bool isShaded = shading == ShadingMode::CPU;
+    const bool isSide = type == LayerType::SIDE;
+    const bool isTop = mesh.GetHeight(k) > 0;
+    const bool isAnalytic = isSide && normals == NormalMode::ANALYTIC;
+
+    const float* ringX[2] = {mesh.GetRingX(k), mesh.GetRingX(k + isSide)};
+    const float* ringY[2] = {mesh.GetRingY(k), mesh.GetRingY(k + isSide)};
+    const float heights[2] = {mesh.GetHeight(k), mesh.GetHeight(k + isSide)};
+    auto setPoint = [&](float* point, SizeType ring, SizeType j) {
+        point[0] = ringX[ring][j];
+        point[1] = ringY[ring][j];
+        point[2] = heights[ring];
+        point[3] = 1;
+    };
+    auto setNormal = [&mesh, k](float* normal, SizeType ring, SizeType j) {
+        normal[0] = mesh.GetRingNormalX(k + ring)[j];
+        normal[1] = mesh.GetRingNormalY(k + ring)[j];
+        normal[2] = mesh.GetRingNormalZ(k + ring)[j];
+    };
 
     for (auto i = 0UL; i < n; i++) {
-        auto first = generateVertex(i, h).GetPosition() * transformMatrix;
-        auto second = generateVertex(i + 1, h).GetPosition() * transformMatrix;
-
-        Vec3 normal = GetNormal(first, center, second);
-        if (CheckNormal(normal, viewPoint)) {
-            Vertices.emplace_back(
-                first,
-                lighting.Calculate(ToVec3(first), normal, ToVec3(color)));
-            Vertices.emplace_back(
-                center,
-                lighting.Calculate(ToVec3(center), normal, ToVec3(color)));
-            Vertices.emplace_back(
-                second,
-                lighting.Calculate(ToVec3(second), normal, ToVec3(color)));
+        for (auto t = 0; t < (isSide ? 2 : 1); t++) {
+            if (output.Visible[t][i] == 0) {
+                continue;
+            }
+
+            float points[3][4];
+            float vertexNormals[3][3];
+            for (auto v = 0; v < 3; v++) {
+                if (isSide) {
+                    const auto corner = SIDE_TRIANGLES[t][v];
+                    setPoint(points[v], corner % 2, i + corner / 2);
+                    if (isAnalytic) {
+                        setNormal(vertexNormals[v], corner % 2,
+                                  i + corner / 2);
+                    }
+                } else if (v == 1) {
+                    const float center[4] = {0, 0, heights[0], 1};
+                    std::copy(center, center + 4, points[v]);
+                } else {
+                    // caps run ring i, center, ring i + 1,
+                    // the other way round on the top
+                    setPoint(points[v], 0, i + ((v == 2) != isTop));
+                }
+            }
+
+            const float faceNormal[3] = {output.NormalX[t][i],
+                                         output.NormalY[t][i],
+                                         output.NormalZ[t][i]};
+            for (auto v = 0; v < 3; v++) {
+                const auto normal = isAnalytic ? vertexNormals[v] : faceNormal;
+                const auto intensity =
+                    isShaded ? output.Intensity[t][v][i] : 1.0f;
+                const float color[4] = {intensity * baseColor[0],
+                                        intensity * baseColor[1],
+                                        intensity * baseColor[2],
+                                        isShaded ? 1.0f : baseColor[3]};
+                emit(points[v], color, normal);
+            }
         }
     }
 }
@@ -183,7 +576,13 @@ Vec3 Layer::GetNormal(const Vec4& first, const Vec4& middle, const Vec4& last) {
     return normal;
 }
 
-bool Layer::CheckNormal(const Vec3& normal, const Vec3& viewPoint) {
+bool Layer::CheckNormal(const Vec3& normal,
+                        const Vec3& viewPoint,
+                        CullingMode culling) {
+    if (culling == CullingMode::GPU) {
+        return true;
+    }
+
     float dotProduct = viewPoint.dot(normal);
     if (dotProduct > 0) {
         return true;
@@ -191,6 +590,79 @@ bool Layer::CheckNormal(const Vec3& normal, const Vec3& viewPoint) {
     return false;
 }
 
+void Layer::AddTriangle(const VertexVector& pool,
+                        IndexType first,
+                        IndexType middle,
+                        IndexType last,
+                        const Vec3& viewPoint) {
+    Vec3 normal =
+        GetNormal(pool[first].GetPosition(), pool[middle].GetPosition(),
+                  pool[last].GetPosition());
+    if (CheckNormal(normal, viewPoint, Culling)) {
+        Indices.insert(Indices.end(), {first, middle, last});
+    }
+}
+
+void Layer::AddStrip(const VertexVector& pool,
+                     const IndexVector& strip,
+                     const Vec3& viewPoint) {
+    bool isRunning = false;
+    for (auto t = 0UL; t + 2 < strip.size(); t++) {
+        const bool isVisible =
+            Culling == CullingMode::GPU ||
+            CheckNormal(GetNormal(pool[strip[t]].GetPosition(),
+                                  pool[strip[t + 1]].GetPosition(),
+                                  pool[strip[t + 2]].GetPosition()),
+                        viewPoint, Culling);
+        if (!isVisible) {
+            if (isRunning) {
+                Indices.push_back(RESTART_INDEX);
+                isRunning = false;
+            }
+            continue;
+        }
+
+        if (!isRunning) {
+            // odd triangles are wound the other way, a repeated first
+            // vertex adds a degenerate one to keep the parity
+            if (t % 2 != 0) {
+                Indices.push_back(strip[t]);
+            }
+            Indices.insert(Indices.end(), {strip[t], strip[t + 1]});
+            isRunning = true;
+        }
+        Indices.push_back(strip[t + 2]);
+    }
+    if (isRunning) {
+        Indices.push_back(RESTART_INDEX);
+    }
+}
+
+SizeType PackedMesh::GetMemorySize() const {
+    return (Block ? Block->GetCapacity() * sizeof(Vertex) : 0) +
+           LayerOffsets.size() * sizeof(SizeType);
+}
+
+PackedMesh PackedMesh::Detach() const {
+    if (!Block) {
+        return *this;
+    }
+
+    const auto count = GetVertexCount();
+    auto block = std::make_shared<VertexBlock>(std::max<SizeType>(count, 1));
+    std::uninitialized_copy_n(Block->GetData(), count, block->GetData());
+    auto offsets = LayerOffsets;
+    return PackedMesh(std::move(block), std::move(offsets));
+}
+
+SizeType IndexedMesh::GetIndexCount() const {
+    SizeType result = 0;
+    for (auto&& layer : Layers) {
+        result += layer.GetItemsCount();
+    }
+    return result;
+}
+
 Ellipsoid::Ellipsoid(LenghtType a,
                      LenghtType b,
                      LenghtType c,
@@ -202,50 +674,296 @@ Ellipsoid::Ellipsoid(LenghtType a,
       C{c},
       VertexCount{vertexCount},
       SurfaceCount{surfaceCount},
-      ViewPoint{viewPoint} {}
+      ViewPoint{viewPoint},
+      Ring{vertexCount} {}
+
+bool Ellipsoid::HasSameShape(const Ellipsoid& other) const {
+    return A == other.A && B == other.B && C == other.C &&
+           VertexCount == other.VertexCount &&
+           SurfaceCount == other.SurfaceCount && Slicing == other.Slicing;
+}
+
+ShapeKey Ellipsoid::GetShapeKey() const {
+    return ShapeKey(A, B, C, VertexCount, SurfaceCount, Slicing);
+}
+
+Vec3 Ellipsoid::GetHalfExtent() const {
+    // the widest ring is the one at zero height
+    return Vec3(A * C, B * C, (STOP_HEIGHT - START_HEIGHT) / 2);
+}
+
+LenghtType Ellipsoid::GetSliceDeviation() const {
+    const auto heights = GenerateHeights();
+    const auto radius = std::max(A, B) * C;
+
+    // the profile is concave, so the chord lies inside and the
+    // deviation peaks somewhere in the middle of each slice
+    LenghtType result = 0;
+    for (auto k = 0UL; k + 1 < heights.size(); k++) {
+        const auto lower = GetProfile(heights[k]);
+        const auto upper = GetProfile(heights[k + 1]);
+        for (auto s = 1UL; s < DEVIATION_SAMPLES; s++) {
+            const auto t = 1.0f * s / DEVIATION_SAMPLES;
+            const auto h = heights[k] + (heights[k + 1] - heights[k]) * t;
+            const auto chord = lower + (upper - lower) * t;
+            result = std::max(result, radius * (GetProfile(h) - chord));
+        }
+    }
+    return result;
+}
+
+ObjectMesh Ellipsoid::GenerateObjectMesh() const {
+    return ObjectMesh(A, B, C, GenerateHeights(), Ring);
+}
+
+ObjectMesh Ellipsoid::GenerateObjectMesh(TessellationCache& cache) const {
+    return cache.Generate(A, B, C, GenerateHeights(), Ring);
+}
 
 LayerVector Ellipsoid::GenerateVertices(const Mat4x4& rotateMatrix,
                                         const Lighting& lighting) const {
+    return GenerateVertices(GenerateObjectMesh(), rotateMatrix, lighting);
+}
+
+LayerVector Ellipsoid::GenerateVertices(const ObjectMesh& mesh,
+                                        const Mat4x4& rotateMatrix,
+                                        const Lighting& lighting,
+                                        ShadingMode shading,
+                                        CullingMode culling,
+                                        NormalMode normals) const {
+    const auto viewPoint = GetObjectViewPoint(rotateMatrix);
+    const auto objectLighting = lighting.ToObjectSpace(rotateMatrix);
+    const auto sideCount = mesh.GetRingCount() - 1;
+    const auto total = sideCount + 2;
+
+    // side slices and both caps are scheduled as one chunked job
+    auto& pool = ThreadPool::GetInstance();
+    const auto chunkSize = std::max<SizeType>(
+        1, total / (pool.GetThreadCount() * CHUNKS_PER_THREAD));
+
+    LayerVector results(total);
+    pool.ParallelFor(total, chunkSize, [&](SizeType begin, SizeType end) {
+        for (auto k = begin; k < end; k++) {
+            if (k < sideCount) {
+                results[k] = Layer(mesh, k, Layer::LayerType::SIDE, viewPoint,
+                                   objectLighting, shading, culling, normals);
+            } else {
+                auto ring = k == sideCount ? 0 : sideCount;
+                results[k] = Layer(mesh, ring, Layer::LayerType::BOTTOM,
+                                   viewPoint, objectLighting, shading, culling);
+            }
+        }
+    });
+
+    LayerVector layers;
+    for (auto&& layer : results) {
+        if (layer.GetItemsCount() != 0) {
+            layers.emplace_back(std::move(layer));
+        }
+    }
+    return layers;
+}
+
+PackedMesh Ellipsoid::GeneratePackedMesh(const ObjectMesh& mesh,
+                                         const Mat4x4& rotateMatrix,
+                                         const Lighting& lighting,
+                                         ShadingMode shading,
+                                         CullingMode culling,
+                                         NormalMode normals,
+                                         VertexArena* arena) const {
+    const auto viewPoint = GetObjectViewPoint(rotateMatrix);
+    const auto objectLighting = lighting.ToObjectSpace(rotateMatrix);
+    const auto sideCount = mesh.GetRingCount() - 1;
+    const auto total = sideCount + 2;
+    auto getRing = [sideCount](SizeType k) {
+        return k < sideCount ? k : k == sideCount ? 0 : sideCount;
+    };
+    auto getType = [sideCount](SizeType k) {
+        return k < sideCount ? Layer::LayerType::SIDE
+                             : Layer::LayerType::BOTTOM;
+    };
+
+    auto& pool = ThreadPool::GetInstance();
+    const auto chunkSize = std::max<SizeType>(
+        1, total / (pool.GetThreadCount() * CHUNKS_PER_THREAD));
+
+    // without an arena everything is allocated for this call only
+    VertexArena localArena;
+    if (arena == nullptr) {
+        arena = &localArena;
+    }
+    // room for the closed mesh, known from the tessellation alone, so
+    // the block keeps fitting while culling changes the count
+    auto block = arena->Acquire(6 * mesh.GetRingSize() * mesh.GetRingCount());
+    const auto scratchSize = Layer::GetScratchSize(mesh);
+    float* const scratch = arena->AcquireScratch(total * scratchSize);
+
+    // first pass counts every layer, so the second one can write
+    // straight to its final place
+    std::vector<SizeType> offsets(total + 1, 0);
+    pool.ParallelFor(total, chunkSize, [&](SizeType begin, SizeType end) {
+        for (auto k = begin; k < end; k++) {
+            offsets[k + 1] = Layer::Prepare(
+                mesh, getRing(k), getType(k), viewPoint, objectLighting,
+                shading, culling, normals, scratch + k * scratchSize);
+        }
+    });
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    PackedMesh packed(std::move(block), std::move(offsets));
+    pool.ParallelFor(total, chunkSize, [&](SizeType begin, SizeType end) {
+        for (auto k = begin; k < end; k++) {
+            Layer::Write(mesh, getRing(k), getType(k), shading, normals,
+                         scratch + k * scratchSize,
+                         packed.GetVertices() + packed.GetLayerOffsets()[k]);
+        }
+    });
+    return packed;
+}
+
+IndexedMesh Ellipsoid::GenerateIndexedMesh(const Mat4x4& rotateMatrix,
+                                           const Lighting& lighting) const {
+    return GenerateIndexedMesh(GenerateObjectMesh(), rotateMatrix, lighting);
+}
+
+IndexedMesh Ellipsoid::GenerateIndexedMesh(const ObjectMesh& mesh,
+                                           const Mat4x4& rotateMatrix,
+                                           const Lighting& lighting,
+                                           ShadingMode shading,
+                                           CullingMode culling,
+                                           Topology topology) const {
+    const auto viewPoint = GetObjectViewPoint(rotateMatrix);
+    const auto objectLighting = lighting.ToObjectSpace(rotateMatrix);
+
+    const auto n = mesh.GetRingSize();
+    const auto ringCount = mesh.GetRingCount();
+    VertexVector vertices;
+    vertices.reserve(ringCount * n + 2 * (n + 1));
+
+    // shades count points in one batch, a flat run shares its normal
+    std::vector<float> intensities(n, 1.0f);
+    auto addVertices = [&](const Vec4* points, const Vec4* normals,
+                           bool isFlat, SizeType count) {
+        if (shading == ShadingMode::CPU) {
+            objectLighting.CalculateIntensities(
+                points->data(), 4, normals->data(), isFlat ? 0 : 4, count,
+                intensities.data());
+        }
+        for (auto i = 0UL; i < count; i++) {
+            const auto& normal = normals[isFlat ? 0 : i];
+            const auto intensity = intensities[i];
+            const auto color =
+                shading == ShadingMode::GPU
+                    ? BASE_COLOR
+                    : Vec4(intensity * BASE_COLOR[0],
+                           intensity * BASE_COLOR[1],
+                           intensity * BASE_COLOR[2], 1);
+            vertices.emplace_back(points[i], color,
+                                  Vec3(normal[0], normal[1], normal[2]));
+        }
+    };
+
+    for (auto k = 0UL; k < ringCount; k++) {
+        addVertices(&mesh.GetPoint(k, 0), &mesh.GetNormal(k, 0), false, n);
+    }
+
+    // caps get their own rings with flat normals
+    SizeType caps[2];
+    const SizeType capRings[2] = {0, ringCount - 1};
+    for (auto c = 0; c < 2; c++) {
+        const auto k = capRings[c];
+        const auto h = mesh.GetHeight(k);
+        const auto normal = Vec4(0, 0, h > 0 ? 1.0f : -1.0f, 0);
+        const auto center = Vec4(0, 0, h, 1);
+        caps[c] = vertices.size();
+        addVertices(&center, &normal, true, 1);
+        addVertices(&mesh.GetPoint(k, 0), &normal, true, n);
+    }
+
     LayerVector layers;
-    float start = -0.1f;
-    float stop = 0.1f;
-    float delta = (stop - start) / SurfaceCount;
-    auto height = start;
-
-    std::vector<std::future<Layer>> futures;
-
-    for (height = start; height <= stop; height += delta) {
-        futures.emplace_back(std::async(
-            std::launch::async,
-            [](float a, float b, float c, float height, SizeType vertexCount,
-               float delta, const Mat4x4& transformMatrix,
-               const Vec3& viewPoint, const Lighting& lighting) {
-                return Layer(a, b, c, height, vertexCount, delta,
-                             transformMatrix, viewPoint, lighting);
-            },
-            A, B, C, height, VertexCount, delta, rotateMatrix, ViewPoint,
-            lighting));
-    }
-
-    for (auto&& future : futures) {
-        future.wait();
-        auto layer = future.get();
+    for (auto k = 0UL; k + 1 < ringCount; k++) {
+        auto layer = Layer(vertices, k * n, (k + 1) * n, n, viewPoint,
+                           culling, topology);
         if (layer.GetItemsCount() != 0) {
-            layers.emplace_back(layer);
+            layers.emplace_back(std::move(layer));
         }
     }
 
-    for (auto h : {start, height}) {
-        auto layer =
-            Layer(A, B, C, h, VertexCount, rotateMatrix, ViewPoint, lighting);
+    for (auto center : caps) {
+        auto layer = Layer(vertices, center, n, viewPoint, culling, topology);
         if (layer.GetItemsCount() != 0) {
-            layers.emplace_back(layer);
+            layers.emplace_back(std::move(layer));
         }
     }
-    return layers;
+
+    return IndexedMesh(std::move(vertices), std::move(layers), topology);
+}
+
+std::vector<LenghtType> Ellipsoid::GenerateHeights() const {
+    if (Slicing == SlicingMode::ADAPTIVE) {
+        return GenerateAdaptiveHeights();
+    }
+
+    // every side layer spans two neighbouring rings, the first and the
+    // last ring are also the cap heights
+    const auto count = std::max<SizeType>(SurfaceCount, 1);
+    std::vector<LenghtType> heights;
+    heights.reserve(count + 1);
+    for (auto k = 0UL; k <= count; k++) {
+        const auto key = GetRingKey(k, count);
+        heights.push_back(START_HEIGHT + (STOP_HEIGHT - START_HEIGHT) *
+                                             key.first / key.second);
+    }
+    return heights;
+}
+
+std::vector<LenghtType> Ellipsoid::GenerateAdaptiveHeights() const {
+    // The chord error of a slice grows with |r''| * dh^2, so equal
+    // errors need slices spaced evenly in the integral of sqrt(|r''|).
+    // For r = sqrt(c^2 - h^2) that is (c^2 - h^2)^(-3/4) up to a factor.
+    auto weight = [this](LenghtType h) {
+        const auto square = std::max(C * C - h * h, 1e-6f);
+        return std::pow(square, -0.75f);
+    };
+
+    const auto step = (STOP_HEIGHT - START_HEIGHT) / ADAPTIVE_SAMPLES;
+    std::vector<float> integral(ADAPTIVE_SAMPLES + 1, 0);
+    for (auto i = 1UL; i <= ADAPTIVE_SAMPLES; i++) {
+        const auto h = START_HEIGHT + i * step;
+        integral[i] =
+            integral[i - 1] + (weight(h - step) + weight(h)) / 2 * step;
+    }
+
+    const auto count = std::max<SizeType>(SurfaceCount, 1);
+    std::vector<LenghtType> heights = {START_HEIGHT};
+    auto j = 1UL;
+    for (auto k = 1UL; k < count; k++) {
+        const auto key = GetRingKey(k, count);
+        const auto target = integral.back() * key.first / key.second;
+        while (j < ADAPTIVE_SAMPLES && integral[j] < target) {
+            j++;
+        }
+        const auto t =
+            (target - integral[j - 1]) / (integral[j] - integral[j - 1]);
+        heights.push_back(START_HEIGHT + (j - 1 + t) * step);
+    }
+    heights.push_back(STOP_HEIGHT);
+    return heights;
+}
+
+LenghtType Ellipsoid::GetProfile(LenghtType height) const {
+    return std::sqrt(std::max(C * C - height * height, 0.0f)) / C;
+}
+
+Ellipsoid::RingKey Ellipsoid::GetRingKey(SizeType k, SizeType count) {
+    const auto divisor = std::gcd(k, count);
+    return RingKey(k / divisor, count / divisor);
 }
 
 void Ellipsoid::SetVertexCount(SizeType count) {
+    if (count != Ring.GetSize()) {
+        Ring = RingTable(count);
+    }
     VertexCount = count;
 }
 
@@ -253,11 +971,8 @@ void Ellipsoid::SetSurfaceCount(SizeType count) {
     SurfaceCount = count;
 }
 
-LayerVector Ellipsoid::ApplyMatrix(const LayerVector& layers,
-                                   const Mat4x4& matrix) {
-    LayerVector result;
-    for (auto&& layer : layers) {
-        result.emplace_back(layer.ApplyMatrix(matrix));
-    }
-    return result;
+Vec3 Ellipsoid::GetObjectViewPoint(const Mat4x4& rotateMatrix) const {
+    Vec4 viewPoint = Vec4(ViewPoint[0], ViewPoint[1], ViewPoint[2], 0) *
+                     rotateMatrix.transpose();
+    return Vec3(viewPoint[0], viewPoint[1], viewPoint[2]);
 }
@@ -0,0 +1,54 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <LevelOfDetail.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+LevelOfDetail::LevelOfDetail(const Vec3& halfExtent, float targetEdge) {
+    const auto PI = 4 * std::atan(1.0f);
+    const auto x = halfExtent[0];
+    const auto y = halfExtent[1];
+    // Ramanujan's approximation of the ellipse perimeter
+    const auto perimeter =
+        PI * (3 * (x + y) - std::sqrt((3 * x + y) * (x + 3 * y)));
+    const auto height = 2 * halfExtent[2];
+
+    auto count = [targetEdge](float length, SizeType min, SizeType max) {
+        const auto result = std::ceil(length / targetEdge);
+        return std::min(std::max(static_cast<SizeType>(result), min), max);
+    };
+
+    for (SizeType i = 0; i < MAX_LEVEL_COUNT; i++) {
+        const auto scale = GetLevelScale(i);
+        Levels.push_back(
+            {count(perimeter * scale, MIN_VERTEX_COUNT, MAX_VERTEX_COUNT),
+             count(height * scale, MIN_SURFACE_COUNT, MAX_SURFACE_COUNT)});
+        if (Levels.back().VertexCount == MAX_VERTEX_COUNT &&
+            Levels.back().SurfaceCount == MAX_SURFACE_COUNT) {
+            break;
+        }
+    }
+}
+
+SizeType LevelOfDetail::Select(float pixelsPerUnit, SizeType current) const {
+    const auto last = Levels.size() - 1;
+    const auto ratio = std::max(pixelsPerUnit / MIN_PIXELS_PER_UNIT, 1.0f);
+    const auto ideal = std::min(
+        static_cast<SizeType>(std::max(std::ceil(std::log2(ratio)), 0.0f)),
+        last);
+
+    current = std::min(current, last);
+    if (ideal < current &&
+        pixelsPerUnit >= HYSTERESIS * GetLevelScale(current - 1)) {
+        return current;
+    }
+    return ideal;
+}
+
+float LevelOfDetail::GetLevelScale(SizeType index) {
+    return std::ldexp(MIN_PIXELS_PER_UNIT, static_cast<int>(index));
+}
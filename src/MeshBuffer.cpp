@@ -0,0 +1,496 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <MeshBuffer.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+
+MeshBuffer::MeshBuffer()
+    : Functions{nullptr},
+      Program{nullptr},
+      Buffer{QOpenGLBuffer::VertexBuffer},
+      IndexBuffer{QOpenGLBuffer::IndexBuffer},
+      InstanceBuffer{QOpenGLBuffer::VertexBuffer},
+      Format{VertexFormat::FULL},
+      Capacity{0},
+      Size{0},
+      IndexCapacity{0},
+      IndexCount{0},
+      IndexSize{sizeof(IndexType)},
+      IndexFormat{GL_UNSIGNED_INT},
+      InstanceCapacity{0},
+      InstanceCount{0},
+      InstanceGeneration{0},
+      UploadedBytes{0},
+      DrawCallCount{0},
+      Generation{0},
+      IsUploaded{false},
+      IsIndexed{false},
+      IsStrip{false},
+      AreInstancesUploaded{false} {}
+
+void MeshBuffer::Create(QOpenGLShaderProgram* program) {
+    Functions = QOpenGLContext::currentContext()
+                    ->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    if (Functions == nullptr || !Functions->initializeOpenGLFunctions()) {
+        qDebug() << "Cannot resolve OpenGL 3.3 functions";
+    }
+
+    if (!Buffer.create()) {
+        qDebug() << "Cannot create buffer";
+    }
+    Buffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    if (!IndexBuffer.create()) {
+        qDebug() << "Cannot create index buffer";
+    }
+    IndexBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    if (!InstanceBuffer.create()) {
+        qDebug() << "Cannot create instance buffer";
+    }
+    InstanceBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+
+    for (auto vertexArray : {&VertexArray, &InstanceVertexArray}) {
+        vertexArray->create();
+        vertexArray->bind();
+        // element buffer binding is part of the VAO state
+        IndexBuffer.bind();
+        vertexArray->release();
+    }
+
+    Program = program;
+    SetAttributes();
+    SetInstanceAttributes();
+}
+
+void MeshBuffer::Destroy() {
+    InstanceVertexArray.destroy();
+    VertexArray.destroy();
+    InstanceBuffer.destroy();
+    IndexBuffer.destroy();
+    Buffer.destroy();
+    DrawFirsts.clear();
+    DrawCounts.clear();
+    Capacity = 0;
+    Size = 0;
+    IndexCapacity = 0;
+    IndexCount = 0;
+    InstanceCapacity = 0;
+    InstanceCount = 0;
+    IsUploaded = false;
+    AreInstancesUploaded = false;
+    Program = nullptr;
+}
+
+void MeshBuffer::SetFormat(VertexFormat format) {
+    if (format == Format) {
+        return;
+    }
+
+    Format = format;
+    IsUploaded = false;
+    if (VertexArray.isCreated()) {
+        SetAttributes();
+    }
+}
+
+SizeType MeshBuffer::GetVertexSize() const {
+    return Format == VertexFormat::COMPACT ? sizeof(CompactVertex)
+                                           : sizeof(Vertex);
+}
+
+void MeshBuffer::Upload(const LayerVector& layers, GenerationType generation) {
+    if (IsUploaded && !IsIndexed && generation == Generation) {
+        return;
+    }
+
+    AllocateVertices(GetVertexCount(layers));
+    Buffer.bind();
+    {
+        SizeType first = 0;
+        for (auto&& layer : layers) {
+            auto& vertices = layer.GetVertices();
+            WriteVertices(first, vertices.data(), vertices.size());
+            first += vertices.size();
+        }
+    }
+    Buffer.release();
+
+    IndexCount = 0;
+    BuildDrawList(layers);
+    Generation = generation;
+    IsUploaded = true;
+    IsIndexed = false;
+}
+
+void MeshBuffer::Upload(const IndexedMesh& mesh, GenerationType generation) {
+    if (IsUploaded && IsIndexed && generation == Generation) {
+        return;
+    }
+
+    auto& vertices = mesh.GetVertices();
+    AllocateVertices(vertices.size());
+    Buffer.bind();
+    WriteVertices(0, vertices.data(), vertices.size());
+    Buffer.release();
+
+    IsStrip = mesh.GetTopology() == Topology::STRIP;
+    WriteIndices(mesh.GetLayers(), vertices.size(), IsStrip);
+    BuildDrawList(mesh.GetLayers());
+    Generation = generation;
+    IsUploaded = true;
+    IsIndexed = true;
+}
+
+void MeshBuffer::Upload(const PackedMesh& mesh, GenerationType generation) {
+    if (IsUploaded && !IsIndexed && generation == Generation) {
+        return;
+    }
+
+    const auto count = mesh.GetVertexCount();
+    const auto bytes = static_cast<int>(count * GetVertexSize());
+    AllocateVertices(count);
+    // culling may leave no faces at all, and an empty range can't be
+    // mapped
+    if (bytes != 0) {
+        Buffer.bind();
+        // the storage was just orphaned, so nothing waits on the mapping
+        auto data = Buffer.mapRange(0, bytes,
+                                    QOpenGLBuffer::RangeWrite |
+                                        QOpenGLBuffer::RangeInvalidateBuffer);
+        if (data == nullptr) {
+            WriteVertices(0, mesh.GetVertices(), count);
+        } else if (Format == VertexFormat::COMPACT) {
+            // quantized straight into the mapping, no staging copy
+            CompactVertex::Convert(mesh.GetVertices(), count,
+                                   static_cast<CompactVertex*>(data));
+            Buffer.unmap();
+            UploadedBytes += bytes;
+        } else {
+            std::memcpy(data, mesh.GetVertices(), bytes);
+            Buffer.unmap();
+            UploadedBytes += bytes;
+        }
+        Buffer.release();
+    }
+
+    // layers are adjacent, so the whole mesh is one range
+    DrawFirsts.clear();
+    DrawCounts.clear();
+    if (count != 0) {
+        DrawFirsts.push_back(0);
+        DrawCounts.push_back(static_cast<GLsizei>(count));
+    }
+    IndexCount = 0;
+    Generation = generation;
+    IsUploaded = true;
+    IsIndexed = false;
+}
+
+void MeshBuffer::UploadInstances(const std::vector<Instance>& instances,
+                                 GenerationType generation) {
+    if (AreInstancesUploaded && generation == InstanceGeneration) {
+        return;
+    }
+
+    InstanceCount = instances.size();
+    InstanceCapacity = Grow(InstanceCapacity, InstanceCount);
+    InstanceBuffer.bind();
+    // orphaned like the vertex storage
+    InstanceBuffer.allocate(
+        static_cast<int>(InstanceCapacity * sizeof(Instance)));
+    InstanceBuffer.write(0, instances.data(),
+                         static_cast<int>(InstanceCount * sizeof(Instance)));
+    InstanceBuffer.release();
+    UploadedBytes += InstanceCount * sizeof(Instance);
+
+    InstanceGeneration = generation;
+    AreInstancesUploaded = true;
+}
+
+void MeshBuffer::Bind() {
+    VertexArray.bind();
+}
+
+void MeshBuffer::Draw() {
+    DrawCallCount = 0;
+    if (DrawCounts.empty()) {
+        return;
+    }
+
+    if (IsIndexed) {
+        DrawOffsets.clear();
+        for (auto first : DrawFirsts) {
+            DrawOffsets.push_back(
+                reinterpret_cast<const void*>(first * IndexSize));
+        }
+
+        const GLenum primitive = IsStrip ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+        if (IsStrip) {
+            Functions->glEnable(GL_PRIMITIVE_RESTART);
+            Functions->glPrimitiveRestartIndex(
+                IndexFormat == GL_UNSIGNED_SHORT
+                    ? std::numeric_limits<std::uint16_t>::max()
+                    : RESTART_INDEX);
+        }
+        if (DrawCounts.size() == 1) {
+            Functions->glDrawElements(primitive, DrawCounts.front(),
+                                      IndexFormat, DrawOffsets.front());
+        } else {
+            Functions->glMultiDrawElements(
+                primitive, DrawCounts.data(), IndexFormat,
+                DrawOffsets.data(), static_cast<GLsizei>(DrawCounts.size()));
+        }
+        if (IsStrip) {
+            Functions->glDisable(GL_PRIMITIVE_RESTART);
+        }
+    } else if (DrawCounts.size() == 1) {
+        Functions->glDrawArrays(GL_TRIANGLES, DrawFirsts.front(),
+                                DrawCounts.front());
+    } else {
+        Functions->glMultiDrawArrays(GL_TRIANGLES, DrawFirsts.data(),
+                                     DrawCounts.data(),
+                                     static_cast<GLsizei>(DrawCounts.size()));
+    }
+    DrawCallCount++;
+}
+
+// OpenGL 3.3 has no instanced multi draw, so every range is a call
+// of its own. Layers of the packed and the indexed meshes are merged
+// into one range anyway.
+void MeshBuffer::DrawInstanced() {
+    DrawCallCount = 0;
+    if (DrawCounts.empty() || InstanceCount == 0) {
+        return;
+    }
+
+    // Draw keeps using VertexArray, which has no instance attributes
+    InstanceVertexArray.bind();
+    const auto instanceCount = static_cast<GLsizei>(InstanceCount);
+    if (IsIndexed) {
+        const GLenum primitive = IsStrip ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+        if (IsStrip) {
+            Functions->glEnable(GL_PRIMITIVE_RESTART);
+            Functions->glPrimitiveRestartIndex(
+                IndexFormat == GL_UNSIGNED_SHORT
+                    ? std::numeric_limits<std::uint16_t>::max()
+                    : RESTART_INDEX);
+        }
+        for (auto i = 0UL; i < DrawCounts.size(); i++) {
+            Functions->glDrawElementsInstanced(
+                primitive, DrawCounts[i], IndexFormat,
+                reinterpret_cast<const void*>(DrawFirsts[i] * IndexSize),
+                instanceCount);
+            DrawCallCount++;
+        }
+        if (IsStrip) {
+            Functions->glDisable(GL_PRIMITIVE_RESTART);
+        }
+    } else {
+        for (auto i = 0UL; i < DrawCounts.size(); i++) {
+            Functions->glDrawArraysInstanced(GL_TRIANGLES, DrawFirsts[i],
+                                             DrawCounts[i], instanceCount);
+            DrawCallCount++;
+        }
+    }
+    VertexArray.bind();
+}
+
+void MeshBuffer::Release() {
+    VertexArray.release();
+}
+
+SizeType MeshBuffer::GetVertexCount(const LayerVector& layers) {
+    SizeType result = 0;
+    for (auto&& layer : layers) {
+        result += layer.GetVertices().size();
+    }
+    return result;
+}
+
+SizeType MeshBuffer::Grow(SizeType capacity, SizeType size) {
+    return size > capacity ? std::max(size, capacity * GROWTH_FACTOR)
+                           : capacity;
+}
+
+// Both VAOs read the mesh. Qt passes normalized = GL_TRUE, which float
+// attributes ignore and the integer ones of the compact format rely on.
+void MeshBuffer::SetAttributes() {
+    for (auto vertexArray : {&VertexArray, &InstanceVertexArray}) {
+        vertexArray->bind();
+        SetVertexAttributes();
+        vertexArray->release();
+    }
+}
+
+// expects the VAO to be bound
+void MeshBuffer::SetVertexAttributes() {
+    const bool isCompact = Format == VertexFormat::COMPACT;
+
+    Buffer.bind();
+    Program->enableAttributeArray(POSITION_LOCATION);
+    Program->enableAttributeArray(COLOR_LOCATION);
+    Program->enableAttributeArray(NORMAL_LOCATION);
+    if (isCompact) {
+        Program->setAttributeBuffer(POSITION_LOCATION, GL_FLOAT,
+                                    CompactVertex::GetPositionOffset(),
+                                    CompactVertex::GetPositionTupleSize(),
+                                    CompactVertex::GetStride());
+        Program->setAttributeBuffer(COLOR_LOCATION, GL_UNSIGNED_BYTE,
+                                    CompactVertex::GetColorOffset(),
+                                    CompactVertex::GetColorTupleSize(),
+                                    CompactVertex::GetStride());
+        Program->setAttributeBuffer(NORMAL_LOCATION, GL_INT_2_10_10_10_REV,
+                                    CompactVertex::GetNormalOffset(),
+                                    CompactVertex::GetNormalTupleSize(),
+                                    CompactVertex::GetStride());
+    } else {
+        Program->setAttributeBuffer(POSITION_LOCATION, GL_FLOAT,
+                                    Vertex::GetPositionOffset(),
+                                    Vertex::GetPositionTupleSize(),
+                                    Vertex::GetStride());
+        Program->setAttributeBuffer(COLOR_LOCATION, GL_FLOAT,
+                                    Vertex::GetColorOffset(),
+                                    Vertex::GetColorTupleSize(),
+                                    Vertex::GetStride());
+        Program->setAttributeBuffer(NORMAL_LOCATION, GL_FLOAT,
+                                    Vertex::GetNormalOffset(),
+                                    Vertex::GetNormalTupleSize(),
+                                    Vertex::GetStride());
+    }
+    Buffer.release();
+}
+
+// read once per instance, the divisor is part of the VAO state
+void MeshBuffer::SetInstanceAttributes() {
+    const struct {
+        int Location;
+        GLenum Type;
+        int Offset;
+        int TupleSize;
+    } attributes[] = {
+        {INSTANCE_POSITION_LOCATION, GL_FLOAT, offsetof(Instance, Position),
+         3},
+        {INSTANCE_AXES_LOCATION, GL_FLOAT, offsetof(Instance, Axes), 3},
+        {INSTANCE_ROTATION_LOCATION, GL_FLOAT, offsetof(Instance, Rotation),
+         4},
+        {INSTANCE_COLOR_LOCATION, GL_UNSIGNED_BYTE, offsetof(Instance, Color),
+         4},
+    };
+
+    InstanceVertexArray.bind();
+    InstanceBuffer.bind();
+    for (auto&& attribute : attributes) {
+        Program->enableAttributeArray(attribute.Location);
+        Program->setAttributeBuffer(attribute.Location, attribute.Type,
+                                    attribute.Offset, attribute.TupleSize,
+                                    sizeof(Instance));
+        Functions->glVertexAttribDivisor(attribute.Location, 1);
+    }
+    InstanceVertexArray.release();
+    InstanceBuffer.release();
+}
+
+void MeshBuffer::AllocateVertices(SizeType count) {
+    Size = count;
+    Capacity = Grow(Capacity, Size);
+
+    Buffer.bind();
+    // Reallocating with the same size orphans the old storage, so the
+    // driver doesn't wait for draws still reading the previous mesh.
+    Buffer.allocate(static_cast<int>(Capacity * GetVertexSize()));
+    Buffer.release();
+}
+
+// expects the vertex buffer to be bound
+void MeshBuffer::WriteVertices(SizeType first,
+                               const Vertex* vertices,
+                               SizeType count) {
+    const auto offset = static_cast<int>(first * GetVertexSize());
+    const auto bytes = static_cast<int>(count * GetVertexSize());
+    if (Format == VertexFormat::COMPACT) {
+        CompactVertices.resize(count);
+        CompactVertex::Convert(vertices, count, CompactVertices.data());
+        Buffer.write(offset, CompactVertices.data(), bytes);
+    } else {
+        Buffer.write(offset, vertices, bytes);
+    }
+    UploadedBytes += bytes;
+}
+
+void MeshBuffer::WriteIndices(const LayerVector& layers,
+                              SizeType poolSize,
+                              bool isStrip) {
+    IndexCount = 0;
+    for (auto&& layer : layers) {
+        IndexCount += layer.GetIndices().size();
+    }
+    IndexCapacity = Grow(IndexCapacity, IndexCount);
+
+    // strips give up the largest short index for the restart marker
+    constexpr auto SHORT_MAX = std::numeric_limits<std::uint16_t>::max();
+    const bool isShort =
+        poolSize <= static_cast<SizeType>(SHORT_MAX) + (isStrip ? 0 : 1);
+    IndexFormat = isShort ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    IndexSize = isShort ? sizeof(std::uint16_t) : sizeof(IndexType);
+
+    // the element buffer may only be bound while the VAO is bound,
+    // releasing it here would detach it from the VAO
+    VertexArray.bind();
+    IndexBuffer.bind();
+    IndexBuffer.allocate(static_cast<int>(IndexCapacity * IndexSize));
+    if (isShort) {
+        // RESTART_INDEX is all ones, so it narrows to the short one
+        ShortIndices.clear();
+        for (auto&& layer : layers) {
+            auto& indices = layer.GetIndices();
+            ShortIndices.insert(ShortIndices.end(), indices.begin(),
+                                indices.end());
+        }
+        IndexBuffer.write(0, ShortIndices.data(),
+                          static_cast<int>(ShortIndices.size() * IndexSize));
+    } else {
+        int offset = 0;
+        for (auto&& layer : layers) {
+            auto& indices = layer.GetIndices();
+            auto bytes = static_cast<int>(indices.size() * IndexSize);
+            IndexBuffer.write(offset, indices.data(), bytes);
+            offset += bytes;
+        }
+    }
+    VertexArray.release();
+    UploadedBytes += IndexCount * IndexSize;
+}
+
+void MeshBuffer::BuildDrawList(const LayerVector& layers) {
+    DrawFirsts.clear();
+    DrawCounts.clear();
+
+    GLint offset = 0;
+    for (auto&& layer : layers) {
+        auto count = static_cast<GLsizei>(layer.GetItemsCount());
+        if (count == 0) {
+            continue;
+        }
+
+        // adjacent ranges are merged, so tightly packed layers
+        // end up as one contiguous draw
+        if (!DrawCounts.empty() &&
+            DrawFirsts.back() + DrawCounts.back() == offset) {
+            DrawCounts.back() += count;
+        } else {
+            DrawFirsts.push_back(offset);
+            DrawCounts.push_back(count);
+        }
+        offset += count;
+    }
+}
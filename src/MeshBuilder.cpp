@@ -0,0 +1,226 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <MeshBuilder.hpp>
+
+SizeType MeshData::GetMemorySize() const {
+    SizeType bytes = Packed.GetMemorySize();
+    auto addLayers = [&bytes](const LayerVector& layers) {
+        for (auto&& layer : layers) {
+            bytes += sizeof(Layer) +
+                     layer.GetVertices().size() * sizeof(Vertex) +
+                     layer.GetIndices().size() * sizeof(IndexType);
+        }
+    };
+    addLayers(Layers);
+    addLayers(Indexed.GetLayers());
+    return bytes + Indexed.GetVertices().size() * sizeof(Vertex);
+}
+
+MeshBuilder::MeshBuilder(Callback onReady)
+    : OnReady{std::move(onReady)},
+      LatestId{0},
+      SupersededCount{0},
+      CacheBudget{DEFAULT_CACHE_BUDGET},
+      IsStopping{false},
+      Geometries{DEFAULT_CACHE_BUDGET},
+      Results{DEFAULT_CACHE_BUDGET},
+      HasGeometry{false},
+      Worker{[this]() { Run(); }} {}
+
+MeshBuilder::~MeshBuilder() {
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        IsStopping = true;
+    }
+    Condition.notify_all();
+    Worker.join();
+}
+
+std::uint64_t MeshBuilder::Post(MeshRequest request) {
+    std::uint64_t id = 0;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (Pending) {
+            SupersededCount++;
+        }
+        Pending = std::move(request);
+        id = ++LatestId;
+    }
+    Condition.notify_one();
+    return id;
+}
+
+TessellationCache::Stats MeshBuilder::GetTessellationStats() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return TessellationStats;
+}
+
+MeshBuilder::GeometryCache::Stats MeshBuilder::GetGeometryCacheStats() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return GeometryStats;
+}
+
+MeshBuilder::ResultCache::Stats MeshBuilder::GetResultCacheStats() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return ResultStats;
+}
+
+void MeshBuilder::Prefetch(MeshRequest request) {
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Prefetches.push_back(std::move(request));
+        if (Prefetches.size() > MAX_PREFETCH_COUNT) {
+            Prefetches.pop_front();
+        }
+    }
+    Condition.notify_one();
+}
+
+MeshBuilder::ResultPointer MeshBuilder::Build(const MeshRequest& request) {
+    Geometries.SetBudget(CacheBudget);
+    Results.SetBudget(CacheBudget);
+
+    auto result = std::make_shared<MeshResult>();
+    result->Mode = request.Mode;
+    result->Shading = request.Shading;
+    result->Culling = request.Culling;
+
+    if (request.DependsOnView()) {
+        UpdateGeometry(request.Object);
+        result->Data = Generate(request, Geometry);
+    } else {
+        const auto key = std::make_tuple(request.Object.GetShapeKey(),
+                                         request.Mode, request.Normals);
+        if (auto cached = Results.Find(key)) {
+            result->Data = *cached;
+        } else {
+            UpdateGeometry(request.Object);
+            result->Data = Generate(request, Geometry);
+            auto stored = ToCached(result->Data);
+            Results.Insert(key, stored, stored->GetMemorySize());
+        }
+    }
+
+    UpdateStats();
+    return result;
+}
+
+// The geometry of the shape on screen stays as it is, so the next build
+// for it doesn't tessellate again
+void MeshBuilder::Warm(const MeshRequest& request) {
+    const auto shapeKey = request.Object.GetShapeKey();
+    const auto key = std::make_tuple(shapeKey, request.Mode, request.Normals);
+    const bool hasResult = request.DependsOnView() || Results.Contains(key);
+    if (!hasResult || !Geometries.Contains(shapeKey)) {
+        ObjectMesh generated;
+        const ObjectMesh* geometry = Geometries.Find(shapeKey);
+        if (geometry == nullptr) {
+            generated = request.Object.GenerateObjectMesh(PrefetchTessellation);
+            Geometries.Insert(shapeKey, generated, generated.GetMemorySize());
+            geometry = &generated;
+        }
+        if (!hasResult) {
+            auto data = ToCached(Generate(request, *geometry));
+            Results.Insert(key, data, data->GetMemorySize());
+        }
+    }
+    UpdateStats();
+}
+
+MeshBuilder::DataPointer MeshBuilder::Generate(const MeshRequest& request,
+                                               const ObjectMesh& geometry) {
+    auto data = std::make_shared<MeshData>();
+    if (request.Mode == MeshMode::INDEXED ||
+        request.Mode == MeshMode::STRIPS) {
+        data->Indexed = request.Object.GenerateIndexedMesh(
+            geometry, request.RotateMatrix, request.Light, request.Shading,
+            request.Culling,
+            request.Mode == MeshMode::STRIPS ? Topology::STRIP
+                                             : Topology::TRIANGLES);
+    } else if (request.Mode == MeshMode::PACKED) {
+        data->Packed = request.Object.GeneratePackedMesh(
+            geometry, request.RotateMatrix, request.Light, request.Shading,
+            request.Culling, request.Normals, &Arena);
+    } else {
+        data->Layers = request.Object.GenerateVertices(
+            geometry, request.RotateMatrix, request.Light, request.Shading,
+            request.Culling, request.Normals);
+    }
+    return data;
+}
+
+// A packed mesh in the cache would keep its arena block and the arena
+// would allocate a new one for every later build
+MeshBuilder::DataPointer MeshBuilder::ToCached(const DataPointer& data) {
+    if (data->Packed.GetVertices() == nullptr) {
+        return data;
+    }
+
+    auto copy = std::make_shared<MeshData>();
+    copy->Packed = data->Packed.Detach();
+    return copy;
+}
+
+void MeshBuilder::UpdateGeometry(const Ellipsoid& object) {
+    if (HasGeometry && GeometryShape.HasSameShape(object)) {
+        return;
+    }
+
+    const auto key = object.GetShapeKey();
+    if (auto cached = Geometries.Find(key)) {
+        Geometry = *cached;
+    } else {
+        Geometry = object.GenerateObjectMesh(Tessellation);
+        Geometries.Insert(key, Geometry, Geometry.GetMemorySize());
+    }
+    GeometryShape = object;
+    HasGeometry = true;
+}
+
+void MeshBuilder::UpdateStats() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    TessellationStats = Tessellation.GetStats();
+    GeometryStats = Geometries.GetStats();
+    ResultStats = Results.GetStats();
+}
+
+void MeshBuilder::Run() {
+    while (true) {
+        std::optional<MeshRequest> request;
+        std::optional<MeshRequest> prefetch;
+        std::uint64_t id = 0;
+        {
+            std::unique_lock<std::mutex> lock(Mutex);
+            Condition.wait(lock, [this]() {
+                return IsStopping || Pending || !Prefetches.empty();
+            });
+            if (IsStopping) {
+                return;
+            }
+            if (Pending) {
+                request.swap(Pending);
+                id = LatestId;
+            } else {
+                prefetch = std::move(Prefetches.front());
+                Prefetches.pop_front();
+            }
+        }
+
+        if (prefetch) {
+            Warm(*prefetch);
+            continue;
+        }
+
+        auto result = Build(*request);
+        result->Id = id;
+
+        if (!IsLatest(id)) {
+            SupersededCount++;
+            continue;
+        }
+        OnReady(std::move(result));
+    }
+}
@@ -9,9 +9,11 @@
 
 #include <cmath>
 
+#include <QComboBox>
 #include <QLineEdit>
 #include <QRegExp>
 #include <QRegExpValidator>
+#include <QSpinBox>
 
 const float MyControlWidget::PI = 4 * std::atan(1.0f);
 const float MyControlWidget::TETA_MAX = 2 * MyControlWidget::PI;
@@ -74,6 +76,8 @@ MyControlWidget::MyControlWidget(QWidget* parent)
                     &MyControlWidget::SpecularChangedSignal);
     connectLineEdit(WidgetUi->diffuseLineEdit,
                     &MyControlWidget::DiffuseChangedSignal);
+    connect(WidgetUi->shineSpinBox, qOverload<int>(&QSpinBox::valueChanged),
+            this, [this](int value) { emit ShineChangedSignal(value); });
 
     auto connectSlider = [this](auto&& slider, auto&& signal) {
         connect(slider, &QSlider::valueChanged, this,
@@ -87,8 +91,36 @@ MyControlWidget::MyControlWidget(QWidget* parent)
                   &MyControlWidget::VertexCountChangedSignal);
     connectSlider(WidgetUi->surfaceSlider,
                   &MyControlWidget::SurfaceCountChangedSignal);
+
+    // render mode params connection
+    ConnectComboBox(WidgetUi->sceneModeComboBox,
+                    &MyControlWidget::SceneModeChangedSignal);
+    ConnectComboBox(WidgetUi->cullingModeComboBox,
+                    &MyControlWidget::CullingModeChangedSignal);
+    ConnectComboBox(WidgetUi->shadingModeComboBox,
+                    &MyControlWidget::ShadingModeChangedSignal);
+    ConnectComboBox(WidgetUi->meshModeComboBox,
+                    &MyControlWidget::MeshModeChangedSignal);
+    ConnectComboBox(WidgetUi->lodModeComboBox,
+                    &MyControlWidget::LodModeChangedSignal);
+    ConnectComboBox(WidgetUi->slicingModeComboBox,
+                    &MyControlWidget::SlicingModeChangedSignal);
+    ConnectComboBox(WidgetUi->vertexFormatComboBox,
+                    &MyControlWidget::VertexFormatChangedSignal);
+    ConnectComboBox(WidgetUi->normalModeComboBox,
+                    &MyControlWidget::NormalModeChangedSignal);
 }
 
 MyControlWidget::~MyControlWidget() {
     delete WidgetUi;
 }
+
+// combo box items follow the order of the mode enum
+template <typename Mode>
+void MyControlWidget::ConnectComboBox(QComboBox* comboBox,
+                                      void (MyControlWidget::*signal)(Mode)) {
+    connect(comboBox, qOverload<int>(&QComboBox::currentIndexChanged), this,
+            [signal, this](int index) {
+                emit std::invoke(signal, this, static_cast<Mode>(index));
+            });
+}
@@ -27,6 +27,10 @@ MyMainWindow::MyMainWindow(QWidget* parent) : QMainWindow(parent) {
     setCentralWidget(CreateCentralWidget());
 }
 
+void MyMainWindow::SetCacheBudget(std::size_t bytes) {
+    OpenGLWidget->SetCacheBudget(bytes);
+}
+
 QWidget* MyMainWindow::CreateCentralWidget() {
     const auto fixedSizePolicy =
         QSizePolicy(QSizePolicy::Fixed, QSizePolicy::Fixed);
@@ -62,6 +66,8 @@ QWidget* MyMainWindow::CreateCentralWidget() {
             OpenGLWidget, &MyOpenGLWidget::SpecularChangedSlot);
     connect(controlWidget, &MyControlWidget::DiffuseChangedSignal, OpenGLWidget,
             &MyOpenGLWidget::DiffuseChangedSlot);
+    connect(controlWidget, &MyControlWidget::ShineChangedSignal, OpenGLWidget,
+            &MyOpenGLWidget::ShineChangedSlot);
 
     // set connection for redraw on vertex or surface count changed
     connect(controlWidget, &MyControlWidget::VertexCountChangedSignal,
@@ -69,6 +75,24 @@ QWidget* MyMainWindow::CreateCentralWidget() {
     connect(controlWidget, &MyControlWidget::SurfaceCountChangedSignal,
             OpenGLWidget, &MyOpenGLWidget::SurfaceCountChangedSlot);
 
+    // set connection for rebuild on render modes changed
+    connect(controlWidget, &MyControlWidget::SceneModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetSceneMode);
+    connect(controlWidget, &MyControlWidget::CullingModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetCullingMode);
+    connect(controlWidget, &MyControlWidget::ShadingModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetShadingMode);
+    connect(controlWidget, &MyControlWidget::MeshModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetMeshMode);
+    connect(controlWidget, &MyControlWidget::LodModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetLodMode);
+    connect(controlWidget, &MyControlWidget::SlicingModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetSlicingMode);
+    connect(controlWidget, &MyControlWidget::VertexFormatChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetVertexFormat);
+    connect(controlWidget, &MyControlWidget::NormalModeChangedSignal,
+            OpenGLWidget, &MyOpenGLWidget::SetNormalMode);
+
     mainLayout->addLayout(toolLayout);
     mainLayout->addWidget(OpenGLWidget);
     widget->setLayout(mainLayout);
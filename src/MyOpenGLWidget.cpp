@@ -7,17 +7,20 @@
 #include <MyMainWindow.hpp>
 #include <MyOpenGLWidget.hpp>
 
+#include <algorithm>
 #include <cmath>
 
 #include <QApplication>
 #include <QDebug>
-#include <QOpenGLBuffer>
+#include <QElapsedTimer>
+#include <QMetaObject>
 #include <QOpenGLContext>
 #include <QOpenGLShaderProgram>
-#include <QOpenGLVertexArrayObject>
 #include <QResizeEvent>
 
 const Vec3 MyOpenGLWidget::VIEW_POINT = Vec3(0, 0, 1);
+const Vec3 MyOpenGLWidget::LIGHT_POSITION = Vec3(1, 0, 0);
+const Vec3 MyOpenGLWidget::TO_OBSERVER = Vec3(0, 0, 1);
 
 MyOpenGLWidget::MyOpenGLWidget(QWidget* parent)
     : MyOpenGLWidget(0.5, 0.5, 0.5, 4, 5, parent) {}
@@ -29,6 +32,11 @@ MyOpenGLWidget::MyOpenGLWidget(LenghtType a,
                                SizeType surfaceCount,
                                QWidget* parent)
     : QOpenGLWidget(parent),
+      ShaderProgram{nullptr},
+      LightingProgram{nullptr},
+      InstanceProgram{nullptr},
+      Mesh{nullptr},
+      Builder{nullptr},
       EllipsoidLayer{a, b, c, vertexCount, surfaceCount, VIEW_POINT},
       ScaleFactor{3.0f},
       AngleOX{0.0},
@@ -37,26 +45,157 @@ MyOpenGLWidget::MyOpenGLWidget(LenghtType a,
       AmbientCoeff{0.5},
       SpecularCoeff{0.5},
       DiffuseCoeff{0.5},
+      ShineCoeff{Lighting::SHINE_COEFF},
       A{a},
       B{b},
       C{c},
       VertexCount{vertexCount},
-      SurfaceCount{surfaceCount} {
+      SurfaceCount{surfaceCount},
+      BuiltData{std::make_shared<MeshData>()},
+      Mode{MeshMode::TRIANGLES},
+      BuiltMode{MeshMode::TRIANGLES},
+      Shading{ShadingMode::CPU},
+      BuiltShading{ShadingMode::CPU},
+      Culling{CullingMode::CPU},
+      BuiltCulling{CullingMode::CPU},
+      Normals{NormalMode::FACE},
+      Format{VertexFormat::FULL},
+      SceneType{SceneMode::SINGLE},
+      BuiltSceneType{SceneMode::SINGLE},
+      SceneGeneration{1},
+      CulledGeneration{0},
+      Lod{LodMode::FIXED},
+      Levels{EllipsoidLayer.GetHalfExtent()},
+      LodLevel{0},
+      MeshGeneration{0},
+      FrameTime{0} {
     auto sizePolicy =
         QSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     setSizePolicy(sizePolicy);
     setMinimumSize(WIDGET_DEFAULT_SIZE);
+
+    // finished meshes are handed over to the GUI thread
+    Builder = new MeshBuilder([this](MeshBuilder::ResultPointer result) {
+        QMetaObject::invokeMethod(
+            this, [this, result]() { ApplyMesh(result); },
+            Qt::QueuedConnection);
+    });
+}
+
+MyOpenGLWidget::~MyOpenGLWidget() {
+    // joins the build thread before anything it reports to goes away
+    delete Builder;
+}
+
+SizeType MyOpenGLWidget::GetDrawCallCount() const {
+    return Mesh != nullptr ? Mesh->GetDrawCallCount() : 0;
+}
+
+VertexArena::Stats MyOpenGLWidget::GetArenaStats() const {
+    return Builder != nullptr ? Builder->GetArenaStats()
+                              : VertexArena::Stats();
+}
+
+TessellationCache::Stats MyOpenGLWidget::GetTessellationStats() const {
+    return Builder != nullptr ? Builder->GetTessellationStats()
+                              : TessellationCache::Stats();
+}
+
+MeshBuilder::GeometryCache::Stats MyOpenGLWidget::GetGeometryCacheStats()
+    const {
+    return Builder != nullptr ? Builder->GetGeometryCacheStats()
+                              : MeshBuilder::GeometryCache::Stats();
+}
+
+MeshBuilder::ResultCache::Stats MyOpenGLWidget::GetResultCacheStats() const {
+    return Builder != nullptr ? Builder->GetResultCacheStats()
+                              : MeshBuilder::ResultCache::Stats();
+}
+
+void MyOpenGLWidget::SetCacheBudget(SizeType bytes) {
+    Builder->SetCacheBudget(bytes);
+}
+
+void MyOpenGLWidget::SetMeshMode(MeshMode mode) {
+    Mode = mode;
+    RequestMesh();
+    OnWidgetUpdate();
+}
+
+void MyOpenGLWidget::SetShadingMode(ShadingMode mode) {
+    Shading = mode;
+    RequestMesh();
+    OnWidgetUpdate();
+}
+
+void MyOpenGLWidget::SetCullingMode(CullingMode mode) {
+    Culling = mode;
+    RequestMesh();
+    OnWidgetUpdate();
+}
+
+void MyOpenGLWidget::SetNormalMode(NormalMode mode) {
+    Normals = mode;
+    RequestMesh();
+    OnWidgetUpdate();
+}
+
+void MyOpenGLWidget::SetSlicingMode(SlicingMode mode) {
+    EllipsoidLayer.SetSlicingMode(mode);
+    RequestMesh();
+    OnWidgetUpdate();
+}
+
+// the mesh itself doesn't change, only the way it is uploaded
+void MyOpenGLWidget::SetVertexFormat(VertexFormat format) {
+    Format = format;
+    if (Mesh != nullptr) {
+        makeCurrent();
+        Mesh->SetFormat(format);
+        doneCurrent();
+    }
+    update();
+}
+
+void MyOpenGLWidget::SetSceneMode(SceneMode mode) {
+    // nothing is generated until the scene is shown for the first time
+    if (mode == SceneMode::INSTANCED && Instances.IsEmpty()) {
+        SetScene(Scene::Generate(DEFAULT_INSTANCE_COUNT, SCENE_RADIUS, 0));
+    }
+    SceneType = mode;
+    RequestMesh();
+    OnWidgetUpdate();
+}
+
+// the unit mesh stays, only the visible instances are uploaded again
+void MyOpenGLWidget::SetScene(Scene scene) {
+    Instances = std::move(scene);
+    SceneGeneration++;
+    update();
+}
+
+void MyOpenGLWidget::SetLodMode(LodMode mode) {
+    Lod = mode;
+    UpdateLevelOfDetail();
+    RequestMesh();
+    OnWidgetUpdate();
 }
 
 void MyOpenGLWidget::ScaleUpSlot() {
     ScaleFactor *= SCALE_FACTOR_PER_ONCE;
-    UpdateOnChange(width(), height());
+    UpdateTransform(width(), height());
+    if (UpdateLevelOfDetail()) {
+        RequestMesh();
+    }
     OnWidgetUpdate();
 }
 
 void MyOpenGLWidget::ScaleDownSlot() {
     ScaleFactor /= SCALE_FACTOR_PER_ONCE;
-    UpdateOnChange(width(), height());
+    UpdateTransform(width(), height());
+    if (UpdateLevelOfDetail()) {
+        RequestMesh();
+    }
     OnWidgetUpdate();
 }
 
@@ -80,31 +219,51 @@ void MyOpenGLWidget::OZAngleChangedSlot(FloatType angle) {
 
 void MyOpenGLWidget::AmbientChangedSlot(float ambientCoeff) {
     AmbientCoeff = ambientCoeff;
-    UpdateOnChange(width(), height());
+    // shader lighting only needs new uniforms
+    if (Shading == ShadingMode::CPU) {
+        RequestMesh();
+    }
     OnWidgetUpdate();
 }
 
 void MyOpenGLWidget::SpecularChangedSlot(float specularCoeff) {
     SpecularCoeff = specularCoeff;
-    UpdateOnChange(width(), height());
+    // shader lighting only needs new uniforms
+    if (Shading == ShadingMode::CPU) {
+        RequestMesh();
+    }
     OnWidgetUpdate();
 }
 
 void MyOpenGLWidget::DiffuseChangedSlot(float diffuseCoeff) {
     DiffuseCoeff = diffuseCoeff;
-    UpdateOnChange(width(), height());
+    // shader lighting only needs new uniforms
+    if (Shading == ShadingMode::CPU) {
+        RequestMesh();
+    }
+    OnWidgetUpdate();
+}
+
+void MyOpenGLWidget::ShineChangedSlot(int shineCoeff) {
+    // the CPU lighting has no exponents above the maximum
+    ShineCoeff = std::min(static_cast<unsigned>(std::max(shineCoeff, 0)),
+                          Lighting::MAX_SHINE_COEFF);
+    // shader lighting only needs new uniforms
+    if (Shading == ShadingMode::CPU) {
+        RequestMesh();
+    }
     OnWidgetUpdate();
 }
 
 void MyOpenGLWidget::VertexCountChangedSlot(int count) {
     VertexCount = static_cast<SizeType>(count);
-    UpdateOnChange(width(), height());
+    RequestMesh();
     OnWidgetUpdate();
 }
 
 void MyOpenGLWidget::SurfaceCountChangedSlot(int count) {
     SurfaceCount = static_cast<SizeType>(count);
-    UpdateOnChange(width(), height());
+    RequestMesh();
     OnWidgetUpdate();
 }
 
@@ -116,151 +275,202 @@ void MyOpenGLWidget::initializeGL() {
     connect(context(), &QOpenGLContext::aboutToBeDestroyed, this,
             &MyOpenGLWidget::CleanUp);
 
-    ShaderProgram = new QOpenGLShaderProgram(this);
-    ShaderProgram->addShaderFromSourceFile(QOpenGLShader::Vertex,
-                                           VERTEX_SHADER);
-    ShaderProgram->addShaderFromSourceFile(QOpenGLShader::Fragment,
-                                           FRAGMENT_SHADER);
-
-    if (!ShaderProgram->link()) {
-        qDebug() << ShaderProgram->log();
-        QApplication::quit();
-    }
-
-    Buffer = new QOpenGLBuffer;
-    Buffer->create();
-    Buffer->bind();
-    Buffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
-    UpdateOnChange(width(), height());
-    Buffer->allocate(GetVertexCount(Layers) * sizeof(Vertex));
-
-    {
-        int offset = 0;
-        for (auto&& layer : Layers) {
-            auto& vertices = layer.GetVertices();
-            auto bytes = vertices.size() * sizeof(Vertex);
-            Buffer->write(offset, vertices.data(), bytes);
-            offset += bytes;
-        }
-    }
-
-    VertexArray = new QOpenGLVertexArrayObject;
-    VertexArray->create();
-    VertexArray->bind();
-
-    int posAttr = ShaderProgram->attributeLocation(POSITION);
-    int colorAttr = ShaderProgram->attributeLocation(COLOR);
-    ShaderProgram->enableAttributeArray(posAttr);
-    ShaderProgram->setAttributeBuffer(
-        posAttr, GL_FLOAT, Vertex::GetPositionOffset(),
-        Vertex::GetPositionTupleSize(), Vertex::GetStride());
-    ShaderProgram->enableAttributeArray(colorAttr);
-    ShaderProgram->setAttributeBuffer(
-        colorAttr, GL_FLOAT, Vertex::GetColorOffset(),
-        Vertex::GetColorTupleSize(), Vertex::GetStride());
+    ShaderProgram = CreateShaderProgram(VERTEX_SHADER, FRAGMENT_SHADER);
+    LightingProgram =
+        CreateShaderProgram(LIGHTING_VERTEX_SHADER, LIGHTING_FRAGMENT_SHADER);
+    InstanceProgram =
+        CreateShaderProgram(INSTANCE_VERTEX_SHADER, LIGHTING_FRAGMENT_SHADER);
 
-    ShaderProgram->disableAttributeArray(posAttr);
-    ShaderProgram->disableAttributeArray(colorAttr);
+    UpdateTransform(width(), height());
+    RequestMesh();
 
-    VertexArray->release();
-    Buffer->release();
+    Mesh = new MeshBuffer;
+    Mesh->SetFormat(Format);
+    Mesh->Create(ShaderProgram);
 }
 
 void MyOpenGLWidget::resizeGL(int width, int height) {
-    UpdateOnChange(width, height);
+    UpdateTransform(width, height);
+    if (UpdateLevelOfDetail()) {
+        RequestMesh();
+    }
 }
 
 void MyOpenGLWidget::paintGL() {
-    if (!ShaderProgram->bind()) {
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool isInstanced = BuiltSceneType == SceneMode::INSTANCED;
+    auto program = isInstanced                        ? InstanceProgram
+                   : BuiltShading == ShadingMode::GPU ? LightingProgram
+                                                      : ShaderProgram;
+    if (!program->bind()) {
         qDebug() << "Cannot bind program";
         QApplication::quit();
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
     glShadeModel(GL_SMOOTH);
-
-    Buffer->destroy();
-    if (!Buffer->create()) {
-        qDebug() << "Cannot create buffer";
+    if (BuiltCulling == CullingMode::GPU) {
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        glFrontFace(GL_CCW);
+    } else {
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
     }
-
-    if (!Buffer->bind()) {
-        qDebug() << "Cannot bind buffer";
+    SetUniformMatrix(program, TRANSFORM_MATRIX, TransformMatrix);
+    if (BuiltShading == ShadingMode::GPU) {
+        SetLightingUniforms(program);
     }
-    Buffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
-    Buffer->allocate(GetVertexCount(Layers) * sizeof(Vertex));
-    {
-        int offset = 0;
-        for (auto&& layer : Layers) {
-            auto& vertices = layer.GetVertices();
-            auto bytes = vertices.size() * sizeof(Vertex);
-            Buffer->write(offset, vertices.data(), bytes);
-            offset += bytes;
-        }
+    if (isInstanced) {
+        const Vec3 scale = Scene::GetUnitScale();
+        program->setUniformValue(MESH_SCALE, scale[0], scale[1], scale[2]);
     }
 
-    VertexArray->destroy();
-    VertexArray->create();
-    VertexArray->bind();
-    int posAttr = ShaderProgram->attributeLocation(POSITION);
-    int colorAttr = ShaderProgram->attributeLocation(COLOR);
-    ShaderProgram->enableAttributeArray(posAttr);
-    ShaderProgram->setAttributeBuffer(
-        posAttr, GL_FLOAT, Vertex::GetPositionOffset(),
-        Vertex::GetPositionTupleSize(), Vertex::GetStride());
-    ShaderProgram->enableAttributeArray(colorAttr);
-    ShaderProgram->setAttributeBuffer(
-        colorAttr, GL_FLOAT, Vertex::GetColorOffset(),
-        Vertex::GetColorTupleSize(), Vertex::GetStride());
-    {
-        int offset = 0;
-        for (auto&& layer : Layers) {
-            int count = layer.GetItemsCount();
-            glDrawArrays(GL_TRIANGLES, offset, count);
-            offset += count;
+    if (BuiltMode == MeshMode::INDEXED || BuiltMode == MeshMode::STRIPS) {
+        Mesh->Upload(BuiltData->Indexed, MeshGeneration);
+    } else if (BuiltMode == MeshMode::PACKED) {
+        Mesh->Upload(BuiltData->Packed, MeshGeneration);
+    } else {
+        Mesh->Upload(BuiltData->Layers, MeshGeneration);
+    }
+    if (isInstanced) {
+        // only the instances in the view reach the instance buffer
+        if (CulledGeneration != SceneGeneration) {
+            SceneCulling = Instances.Cull(TransformMatrix, VisibleInstances);
+            CulledGeneration = SceneGeneration;
         }
+        Mesh->UploadInstances(VisibleInstances, SceneGeneration);
     }
+    Mesh->Bind();
+    if (isInstanced) {
+        Mesh->DrawInstanced();
+    } else {
+        Mesh->Draw();
+    }
+    Mesh->Release();
+    program->release();
 
-    ShaderProgram->disableAttributeArray(posAttr);
-    ShaderProgram->disableAttributeArray(colorAttr);
-
-    Buffer->release();
-    VertexArray->release();
-    ShaderProgram->release();
+    FrameTime = timer.nsecsElapsed();
 }
 
 void MyOpenGLWidget::CleanUp() {
-    VertexArray->destroy();
-    Buffer->destroy();
-    delete VertexArray;
-    delete Buffer;
+    Mesh->Destroy();
+    delete Mesh;
     delete ShaderProgram;
+    delete LightingProgram;
+    delete InstanceProgram;
+    Mesh = nullptr;
 }
 
-SizeType MyOpenGLWidget::GetVertexCount(const LayerVector& layers) {
-    SizeType result = 0;
-    for (auto&& layer : layers) {
-        result += layer.GetVertices().size();
+void MyOpenGLWidget::UpdateOnChange(int width, int height) {
+    UpdateTransform(width, height);
+    if (DependsOnView()) {
+        RequestMesh();
     }
-    return result;
 }
 
-void MyOpenGLWidget::UpdateOnChange(int width, int height) {
-    const Mat4x4 rotateMatrix = GenerateRotateMatrix(RotateType::OX) *
-                                GenerateRotateMatrix(RotateType::OY) *
-                                GenerateRotateMatrix(RotateType::OZ);
+void MyOpenGLWidget::UpdateTransform(int width, int height) {
     const Mat4x4 projectionMatrix = GenerateProjectionMatrix();
     const Mat4x4 scaleMatrix = GenerateScaleMatrix(width, height);
-    const Mat4x4 transformMatrix = scaleMatrix * projectionMatrix;
+    RotateMatrix = GenerateRotateMatrix();
+    TransformMatrix = RotateMatrix * scaleMatrix * projectionMatrix;
+    SceneGeneration++;
+}
 
-    Vec3 light = Vec3(1, 0, 0);
-    Vec3 toObserver = Vec3(0, 0, 1);
-    Lighting lighting = {AmbientCoeff, SpecularCoeff, DiffuseCoeff, light,
-                         toObserver};
-    EllipsoidLayer.SetVertexCount(VertexCount);
-    EllipsoidLayer.SetSurfaceCount(SurfaceCount);
-    Layers = EllipsoidLayer.GenerateVertices(rotateMatrix, lighting);
-    SetUniformMatrix(transformMatrix);
+void MyOpenGLWidget::RequestMesh() {
+    auto vertexCount = VertexCount;
+    auto surfaceCount = SurfaceCount;
+    if (Lod == LodMode::AUTO) {
+        const auto& level = Levels.GetLevel(LodLevel);
+        vertexCount = level.VertexCount;
+        surfaceCount = level.SurfaceCount;
+    }
+    if (SceneType == SceneMode::INSTANCED) {
+        // one mesh for the whole scene, whatever its size
+        Builder->Post(CreateRequest(
+            Scene::GetUnitEllipsoid(vertexCount, surfaceCount, VIEW_POINT)));
+        return;
+    }
+    EllipsoidLayer.SetVertexCount(vertexCount);
+    EllipsoidLayer.SetSurfaceCount(surfaceCount);
+    Builder->Post(CreateRequest(EllipsoidLayer));
+
+    if (Lod == LodMode::AUTO) {
+        // neighbouring levels are cached before zooming reaches them,
+        // until then the current mesh stays on screen
+        for (auto index : {LodLevel + 1, LodLevel - 1}) {
+            // below level 0 wraps around and is skipped too
+            if (index >= Levels.GetLevelCount()) {
+                continue;
+            }
+            auto object = EllipsoidLayer;
+            object.SetVertexCount(Levels.GetLevel(index).VertexCount);
+            object.SetSurfaceCount(Levels.GetLevel(index).SurfaceCount);
+            Builder->Prefetch(CreateRequest(object));
+        }
+    }
+}
+
+MeshRequest MyOpenGLWidget::CreateRequest(const Ellipsoid& object) const {
+    // the mesh stays in object space, the rotation only orients
+    // culling and lighting
+    const Mat4x4 rotateMatrix = GenerateRotateMatrix();
+
+    Lighting lighting = {AmbientCoeff, SpecularCoeff, DiffuseCoeff,
+                         LIGHT_POSITION, TO_OBSERVER, ShineCoeff};
+    MeshRequest request = {object,  rotateMatrix, lighting, Mode,
+                           Shading, Culling,      Normals};
+    // instances are oriented differently, so the shared mesh is lit
+    // and culled in the shader and doesn't depend on the view
+    if (SceneType == SceneMode::INSTANCED) {
+        request.Shading = ShadingMode::GPU;
+        request.Culling = CullingMode::GPU;
+    }
+    return request;
+}
+
+bool MyOpenGLWidget::UpdateLevelOfDetail() {
+    if (Lod != LodMode::AUTO) {
+        return false;
+    }
+
+    const auto level = Levels.Select(GetPixelsPerUnit(), LodLevel);
+    const bool isChanged = level != LodLevel;
+    LodLevel = level;
+    return isChanged;
+}
+
+float MyOpenGLWidget::GetPixelsPerUnit() const {
+    // normalized device coordinates span two units across the viewport
+    const Mat4x4 scaleMatrix = GenerateScaleMatrix(width(), height());
+    return std::max(scaleMatrix(0, 0) * width(),
+                    scaleMatrix(1, 1) * height()) /
+           2;
+}
+
+bool MyOpenGLWidget::DependsOnView() const {
+    // a closed mesh lit in the shader is the same for every rotation
+    return SceneType != SceneMode::INSTANCED &&
+           (Culling == CullingMode::CPU || Shading == ShadingMode::CPU);
+}
+
+void MyOpenGLWidget::ApplyMesh(MeshBuilder::ResultPointer result) {
+    // a newer request is already in flight, wait for it instead
+    if (!Builder->IsLatest(result->Id)) {
+        return;
+    }
+
+    BuiltData = std::move(result->Data);
+    BuiltMode = result->Mode;
+    BuiltShading = result->Shading;
+    BuiltCulling = result->Culling;
+    // the latest request was made in the current scene mode
+    BuiltSceneType = SceneType;
+    MeshGeneration++;
+    update();
 }
 
 void MyOpenGLWidget::OnWidgetUpdate() {
@@ -297,6 +507,12 @@ Mat4x4 MyOpenGLWidget::GenerateScaleMatrix(int width, int height) const {
     return Map4x4(matrixData);
 }
 
+Mat4x4 MyOpenGLWidget::GenerateRotateMatrix() const {
+    return GenerateRotateMatrix(RotateType::OX) *
+           GenerateRotateMatrix(RotateType::OY) *
+           GenerateRotateMatrix(RotateType::OZ);
+}
+
 Mat4x4 MyOpenGLWidget::GenerateRotateMatrix(RotateType rotateType) const {
     FloatType angle = 0;
     switch (rotateType) {
@@ -389,20 +605,60 @@ Mat4x4 MyOpenGLWidget::GenerateRotateMatrixByAngle(RotateType rotateType,
 }
 
 Mat4x4 MyOpenGLWidget::GenerateProjectionMatrix() {
+    // z is kept for the depth test, flipped so the viewer side is nearer
     FloatType matrixData[] = {
-        1, 0, 0, 0,  // first line
-        0, 1, 0, 0,  // second line
-        0, 0, 0, 0,  // third line
-        0, 0, 0, 1   // fourth line
+        1, 0, 0,  0,  // first line
+        0, 1, 0,  0,  // second line
+        0, 0, -1, 0,  // third line
+        0, 0, 0,  1   // fourth line
     };
 
     return Map4x4(matrixData);
 }
 
-void MyOpenGLWidget::SetUniformMatrix(const Mat4x4& transformMatrix) {
-    ShaderProgram->bind();
+QOpenGLShaderProgram* MyOpenGLWidget::CreateShaderProgram(
+    const char* vertexShader,
+    const char* fragmentShader) {
+    auto program = new QOpenGLShaderProgram(this);
+    program->addShaderFromSourceFile(QOpenGLShader::Vertex, vertexShader);
+    program->addShaderFromSourceFile(QOpenGLShader::Fragment, fragmentShader);
+
+    // fixed locations let every program share the mesh VAO
+    program->bindAttributeLocation(POSITION, MeshBuffer::POSITION_LOCATION);
+    program->bindAttributeLocation(COLOR, MeshBuffer::COLOR_LOCATION);
+    program->bindAttributeLocation(NORMAL, MeshBuffer::NORMAL_LOCATION);
+    program->bindAttributeLocation(INSTANCE_POSITION,
+                                   MeshBuffer::INSTANCE_POSITION_LOCATION);
+    program->bindAttributeLocation(INSTANCE_AXES,
+                                   MeshBuffer::INSTANCE_AXES_LOCATION);
+    program->bindAttributeLocation(INSTANCE_ROTATION,
+                                   MeshBuffer::INSTANCE_ROTATION_LOCATION);
+    program->bindAttributeLocation(INSTANCE_COLOR,
+                                   MeshBuffer::INSTANCE_COLOR_LOCATION);
+
+    if (!program->link()) {
+        qDebug() << program->log();
+        QApplication::quit();
+    }
+    return program;
+}
+
+void MyOpenGLWidget::SetLightingUniforms(QOpenGLShaderProgram* program) {
+    SetUniformMatrix(program, ROTATE_MATRIX, RotateMatrix);
+    program->setUniformValue(AMBIENT_COEFF, AmbientCoeff);
+    program->setUniformValue(SPECULAR_COEFF, SpecularCoeff);
+    program->setUniformValue(DIFFUSE_COEFF, DiffuseCoeff);
+    program->setUniformValue(SHINE_COEFF, static_cast<GLfloat>(ShineCoeff));
+    program->setUniformValue(LIGHT, LIGHT_POSITION[0], LIGHT_POSITION[1],
+                             LIGHT_POSITION[2]);
+    program->setUniformValue(TO_OBSERVER_VEC, TO_OBSERVER[0], TO_OBSERVER[1],
+                             TO_OBSERVER[2]);
+}
 
-    ShaderProgram->setUniformValue(TRANSFORM_MATRIX,
-                                   QMatrix4x4(transformMatrix.data()));
-    ShaderProgram->release();
+void MyOpenGLWidget::SetUniformMatrix(QOpenGLShaderProgram* program,
+                                      const char* name,
+                                      const Mat4x4& matrix) {
+    // QMatrix4x4 takes row-major data, Eigen stores columns
+    const Eigen::Matrix<float, 4, 4, Eigen::RowMajor> rowMajor = matrix;
+    program->setUniformValue(name, QMatrix4x4(rowMajor.data()));
 }
@@ -0,0 +1,71 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <RingKernelImpl.hpp>
+
+RingKernel::Level RingKernel::CurrentLevel = RingKernel::GetSupportedLevel();
+
+void RingKernel::Run(const Input& input, const Output& output) {
+    switch (CurrentLevel) {
+        case Level::AVX:
+            RunAvx(input, output);
+            break;
+        case Level::SSE:
+            RunSse(input, output);
+            break;
+        case Level::SCALAR:
+            RunScalar(input, output);
+            break;
+    }
+}
+
+RingKernel::Level RingKernel::GetLevel() {
+    return CurrentLevel;
+}
+
+RingKernel::Level RingKernel::GetSupportedLevel() {
+#if defined(__x86_64__) || defined(__i386__)
+    // CurrentLevel is set from a static initializer, which may run
+    // before the CPU model has been initialized
+    __builtin_cpu_init();
+    if (HasAvx() && __builtin_cpu_supports("avx")) {
+        return Level::AVX;
+    }
+#endif
+#ifdef __SSE2__
+    return Level::SSE;
+#else
+    return Level::SCALAR;
+#endif
+}
+
+void RingKernel::SetLevel(Level level) {
+    const auto supported = GetSupportedLevel();
+    CurrentLevel = level < supported ? level : supported;
+}
+
+const char* RingKernel::GetLevelName(Level level) {
+    switch (level) {
+        case Level::AVX:
+            return "avx";
+        case Level::SSE:
+            return "sse";
+        case Level::SCALAR:
+            return "scalar";
+    }
+    return "";
+}
+
+void RingKernel::RunScalar(const Input& input, const Output& output) {
+    RunKernel<ScalarBatch>(input, output);
+}
+
+void RingKernel::RunSse(const Input& input, const Output& output) {
+#ifdef __SSE2__
+    RunKernel<SseBatch>(input, output);
+#else
+    RunKernel<ScalarBatch>(input, output);
+#endif
+}
@@ -0,0 +1,25 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+// Built with -mavx where the compiler supports it. Only called after
+// the CPU has been checked, see RingKernel::GetSupportedLevel.
+
+#include <RingKernelImpl.hpp>
+
+bool RingKernel::HasAvx() {
+#ifdef __AVX__
+    return true;
+#else
+    return false;
+#endif
+}
+
+void RingKernel::RunAvx(const Input& input, const Output& output) {
+#ifdef __AVX__
+    RunKernel<AvxBatch>(input, output);
+#else
+    RunScalar(input, output);
+#endif
+}
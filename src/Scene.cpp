@@ -0,0 +1,263 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <Scene.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+Bounds Bounds::Merge(const Bounds& first, const Bounds& second) {
+    const Vec3 lower = (first.Center - first.Extent)
+                           .cwiseMin(second.Center - second.Extent);
+    const Vec3 upper = (first.Center + first.Extent)
+                           .cwiseMax(second.Center + second.Extent);
+    return {(lower + upper) / 2, (upper - lower) / 2};
+}
+
+Frustum::Frustum(const Mat4x4& transform) {
+    // clip = (point, 1) * transform, inside if -w <= clip[k] <= w
+    const Vec4 w = transform.col(3).transpose();
+    for (auto k = 0; k < 3; k++) {
+        const Vec4 column = transform.col(k).transpose();
+        Planes[2 * k] = w + column;
+        Planes[2 * k + 1] = w - column;
+    }
+}
+
+Frustum::Side Frustum::Classify(const Bounds& bounds) const {
+    auto side = Side::INSIDE;
+    for (auto&& plane : Planes) {
+        const Vec3 normal = plane.head<3>();
+        const auto distance = normal.dot(bounds.Center) + plane[3];
+        const auto radius = normal.cwiseAbs().dot(bounds.Extent);
+        if (distance + radius < 0) {
+            return Side::OUTSIDE;
+        }
+        if (distance - radius < 0) {
+            side = Side::INTERSECTS;
+        }
+    }
+    return side;
+}
+
+void Scene::Add(const Instance& instance) {
+    Instances.push_back(instance);
+    IsIndexed = false;
+}
+
+void Scene::Clear() {
+    Instances.clear();
+    IsIndexed = false;
+}
+
+Scene::CullStats Scene::Cull(const Mat4x4& transform,
+                             std::vector<Instance>& visible) {
+    visible.clear();
+    CullStats stats;
+    if (Instances.empty()) {
+        return stats;
+    }
+    if (!IsIndexed) {
+        BuildIndex();
+    }
+
+    CullNode(Frustum(transform), 0, visible, stats);
+    stats.Visible = visible.size();
+    stats.Culled = Instances.size() - visible.size();
+    return stats;
+}
+
+Ellipsoid Scene::GetUnitEllipsoid(SizeType vertexCount,
+                                  SizeType surfaceCount,
+                                  const Vec3& viewPoint) {
+    // semi-axes are (a * c, b * c, c), the rings reach the poles when
+    // c is the layer half height
+    const auto height = Ellipsoid::GetMaxHeight();
+    return Ellipsoid(1 / height, 1 / height, height, vertexCount,
+                     surfaceCount, viewPoint);
+}
+
+Vec3 Scene::GetUnitScale() {
+    return Vec3(1, 1, 1 / Ellipsoid::GetMaxHeight());
+}
+
+Bounds Scene::GetBounds(const Instance& instance) {
+    const auto x = instance.Rotation[0];
+    const auto y = instance.Rotation[1];
+    const auto z = instance.Rotation[2];
+    const auto w = instance.Rotation[3];
+    // rotation of the unit quaternion, columns are the rotated axes
+    const float rotation[3][3] = {
+        {1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w)},
+        {2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w)},
+        {2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y)}};
+
+    // farthest point of the ellipsoid along every world axis
+    Bounds result;
+    for (auto i = 0; i < 3; i++) {
+        float squared = 0;
+        for (auto j = 0; j < 3; j++) {
+            const auto projected = rotation[i][j] * instance.Axes[j];
+            squared += projected * projected;
+        }
+        result.Center[i] = instance.Position[i];
+        result.Extent[i] = std::sqrt(squared);
+    }
+    return result;
+}
+
+Scene Scene::Generate(SizeType count, float radius, unsigned seed) {
+    Scene result;
+    if (count == 0) {
+        return result;
+    }
+
+    SizeType side = 1;
+    while (side * side * side < count) {
+        side++;
+    }
+    // the grid cube fits in the sphere and every instance in its cell
+    const auto half = radius / std::sqrt(3.0f);
+    const auto cell = 2 * half / side;
+    const auto maxAxis = 0.45f * cell;
+
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> axis(0.2f * cell, maxAxis);
+    std::uniform_real_distribution<float> jitter(-(cell / 2 - maxAxis),
+                                                 cell / 2 - maxAxis);
+    std::normal_distribution<float> gauss;
+    std::uniform_int_distribution<int> channel(64, 255);
+
+    result.Instances.reserve(count);
+    for (SizeType i = 0; i < count; i++) {
+        Instance instance;
+        const SizeType cellIndex[3] = {i % side, i / side % side,
+                                       i / side / side};
+        for (auto j = 0; j < 3; j++) {
+            instance.Position[j] =
+                -half + (cellIndex[j] + 0.5f) * cell + jitter(random);
+            instance.Axes[j] = axis(random);
+        }
+
+        // normalized gaussian samples are uniform on the sphere
+        float norm = 0;
+        for (auto& component : instance.Rotation) {
+            component = gauss(random);
+            norm += component * component;
+        }
+        norm = std::sqrt(norm);
+        for (auto& component : instance.Rotation) {
+            component = norm != 0 ? component / norm : 0;
+        }
+        if (norm == 0) {
+            instance.Rotation[3] = 1;
+        }
+
+        for (auto j = 0; j < 3; j++) {
+            instance.Color[j] = static_cast<std::uint8_t>(channel(random));
+        }
+        instance.Color[3] = 255;
+        result.Add(instance);
+    }
+    return result;
+}
+
+void Scene::BuildIndex() {
+    InstanceBounds.resize(Instances.size());
+    Order.resize(Instances.size());
+    for (auto i = 0UL; i < Instances.size(); i++) {
+        InstanceBounds[i] = GetBounds(Instances[i]);
+        Order[i] = i;
+    }
+
+    // a binary tree with leaves of up to LEAF_SIZE has fewer nodes
+    // than twice the instances
+    Nodes.clear();
+    Nodes.reserve(2 * Instances.size());
+    BuildNode(0, Instances.size());
+
+    // leaves copy adjacent instances instead of gathering them
+    SortedInstances.resize(Instances.size());
+    SortedBounds.resize(Instances.size());
+    for (auto i = 0UL; i < Instances.size(); i++) {
+        SortedInstances[i] = Instances[Order[i]];
+        SortedBounds[i] = InstanceBounds[Order[i]];
+    }
+    IsIndexed = true;
+}
+
+// splits at the median center along the longest side of the centers
+SizeType Scene::BuildNode(SizeType first, SizeType count) {
+    const auto index = Nodes.size();
+    Nodes.push_back({InstanceBounds[Order[first]], first, count, 0});
+
+    Vec3 lower = InstanceBounds[Order[first]].Center;
+    Vec3 upper = lower;
+    for (auto i = first + 1; i < first + count; i++) {
+        const auto& bounds = InstanceBounds[Order[i]];
+        Nodes[index].Box = Bounds::Merge(Nodes[index].Box, bounds);
+        lower = lower.cwiseMin(bounds.Center);
+        upper = upper.cwiseMax(bounds.Center);
+    }
+    if (count <= LEAF_SIZE) {
+        return index;
+    }
+
+    Vec3::Index axis = 0;
+    (upper - lower).maxCoeff(&axis);
+    const auto begin = Order.begin() + first;
+    const auto half = count / 2;
+    std::nth_element(begin, begin + half, begin + count,
+                     [this, axis](SizeType left, SizeType right) {
+                         return InstanceBounds[left].Center[axis] <
+                                InstanceBounds[right].Center[axis];
+                     });
+
+    Nodes[index].Count = 0;
+    BuildNode(first, half);
+    const auto second = BuildNode(first + half, count - half);
+    Nodes[index].Second = second;
+    return index;
+}
+
+void Scene::CullNode(const Frustum& frustum,
+                     SizeType node,
+                     std::vector<Instance>& visible,
+                     CullStats& stats) const {
+    const auto& current = Nodes[node];
+    stats.Tests++;
+    const auto side = frustum.Classify(current.Box);
+    if (side == Frustum::Side::OUTSIDE) {
+        return;
+    }
+    if (side == Frustum::Side::INSIDE) {
+        AddNode(node, visible);
+        return;
+    }
+
+    if (current.Count == 0) {
+        CullNode(frustum, node + 1, visible, stats);
+        CullNode(frustum, current.Second, visible, stats);
+        return;
+    }
+    for (auto i = current.First; i < current.First + current.Count; i++) {
+        stats.Tests++;
+        if (frustum.Classify(SortedBounds[i]) != Frustum::Side::OUTSIDE) {
+            visible.push_back(SortedInstances[i]);
+        }
+    }
+}
+
+// instances of a subtree are adjacent
+void Scene::AddNode(SizeType node, std::vector<Instance>& visible) const {
+    auto last = node;
+    while (Nodes[last].Count == 0) {
+        last = Nodes[last].Second;
+    }
+    const auto begin = SortedInstances.begin();
+    visible.insert(visible.end(), begin + Nodes[node].First,
+                   begin + Nodes[last].First + Nodes[last].Count);
+}
@@ -0,0 +1,111 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <ThreadPool.hpp>
+
+ThreadPool::ThreadPool(SizeType threadCount)
+    : PendingCount{0}, NextQueue{0}, IsStopping{false} {
+    threadCount = std::max<SizeType>(threadCount, 1);
+    for (SizeType i = 0; i < threadCount; i++) {
+        Queues.emplace_back(std::make_unique<Queue>());
+    }
+    for (SizeType i = 0; i < threadCount; i++) {
+        Workers.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(WakeMutex);
+        IsStopping = true;
+    }
+    WakeCondition.notify_all();
+
+    for (auto&& worker : Workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(Task task) {
+    // counted before it becomes visible, so a worker that pops it
+    // never sees the counter underflow
+    {
+        std::lock_guard<std::mutex> lock(WakeMutex);
+        PendingCount++;
+    }
+
+    const auto index = NextQueue++ % Queues.size();
+    {
+        std::lock_guard<std::mutex> lock(Queues[index]->Mutex);
+        Queues[index]->Tasks.push_back(std::move(task));
+    }
+    WakeCondition.notify_one();
+}
+
+ThreadPool& ThreadPool::GetInstance() {
+    return *GetInstancePointer();
+}
+
+void ThreadPool::SetInstanceThreadCount(SizeType threadCount) {
+    auto& instance = GetInstancePointer();
+    if (instance->GetThreadCount() != std::max<SizeType>(threadCount, 1)) {
+        instance = std::make_unique<ThreadPool>(threadCount);
+    }
+}
+
+std::unique_ptr<ThreadPool>& ThreadPool::GetInstancePointer() {
+    static auto instance =
+        std::make_unique<ThreadPool>(std::thread::hardware_concurrency());
+    return instance;
+}
+
+bool ThreadPool::PopTask(SizeType index, Task& task) {
+    if (index < Queues.size()) {
+        auto& own = *Queues[index];
+        std::lock_guard<std::mutex> lock(own.Mutex);
+        if (!own.Tasks.empty()) {
+            task = std::move(own.Tasks.back());
+            own.Tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (SizeType i = 0; i < Queues.size(); i++) {
+        auto& victim = *Queues[(index + i + 1) % Queues.size()];
+        std::lock_guard<std::mutex> lock(victim.Mutex);
+        if (!victim.Tasks.empty()) {
+            task = std::move(victim.Tasks.front());
+            victim.Tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::RunPendingTask(SizeType index) {
+    Task task;
+    if (!PopTask(index, task)) {
+        return false;
+    }
+
+    PendingCount--;
+    task();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(SizeType index) {
+    while (true) {
+        if (RunPendingTask(index)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(WakeMutex);
+        WakeCondition.wait(
+            lock, [this]() { return IsStopping || PendingCount > 0; });
+        if (IsStopping && PendingCount == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+// Computer graphic lab 3
+// Variant 20
+// Copyright © 2017-2018 Roman Khomenko (8O-308)
+// All rights reserved
+
+#include <VertexArena.hpp>
+
+#include <atomic>
+#include <new>
+
+VertexBlock::VertexBlock(SizeType capacity)
+    : Data{static_cast<Vertex*>(::operator new(capacity * sizeof(Vertex)))},
+      Capacity{capacity} {}
+
+VertexArena::BlockPointer VertexArena::Acquire(SizeType capacity) {
+    // a block nobody else holds is free, the mesh that used it is gone
+    auto isFree = [](const BlockPointer& block) {
+        return !block || block.use_count() == 1;
+    };
+
+    for (auto&& block : Blocks) {
+        if (isFree(block) && block && block->GetCapacity() >= capacity) {
+            // pairs with the release of the last outside reference
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::lock_guard<std::mutex> lock(StatsMutex);
+            Counters.Reuses++;
+            return block;
+        }
+    }
+
+    auto block = std::make_shared<VertexBlock>(capacity);
+    CountAllocation(capacity * sizeof(Vertex));
+    for (auto&& slot : Blocks) {
+        if (isFree(slot)) {
+            slot = block;
+            UpdateReserved();
+            break;
+        }
+    }
+    return block;
+}
+
+float* VertexArena::AcquireScratch(SizeType size) {
+    if (Scratch.size() < size) {
+        Scratch.resize(size);
+        CountAllocation(size * sizeof(float));
+        UpdateReserved();
+    }
+    return Scratch.data();
+}
+
+VertexArena::Stats VertexArena::GetStats() const {
+    std::lock_guard<std::mutex> lock(StatsMutex);
+    return Counters;
+}
+
+void VertexArena::CountAllocation(SizeType bytes) {
+    std::lock_guard<std::mutex> lock(StatsMutex);
+    Counters.Allocations++;
+    Counters.AllocatedBytes += bytes;
+}
+
+void VertexArena::UpdateReserved() {
+    SizeType bytes = Scratch.size() * sizeof(float);
+    for (auto&& block : Blocks) {
+        if (block) {
+            bytes += block->GetCapacity() * sizeof(Vertex);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(StatsMutex);
+    Counters.ReservedBytes = bytes;
+}
@@ -6,6 +6,8 @@
 #include <MyMainWindow.hpp>
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
 
 void Init() {
     Q_INIT_RESOURCE(resources);
@@ -20,7 +22,30 @@ int main(int argc, char* argv[]) {
 
     Init();
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription(MyMainWindow::VARIANT_DESCRIPTION);
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption cacheBudgetOption(
+        "cache-budget",
+        "Bytes of meshes kept by each mesh builder cache, 0 disables them.",
+        "bytes");
+    parser.addOption(cacheBudgetOption);
+    parser.process(a);
+
     MyMainWindow w;
+    if (parser.isSet(cacheBudgetOption)) {
+        bool isValid = false;
+        const auto bytes =
+            parser.value(cacheBudgetOption).toULongLong(&isValid);
+        if (!isValid) {
+            qDebug() << "Invalid cache budget:"
+                     << parser.value(cacheBudgetOption);
+            return 1;
+        }
+        w.SetCacheBudget(bytes);
+    }
     w.show();
 
     return a.exec();